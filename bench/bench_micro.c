@@ -0,0 +1,316 @@
+/* Microbenchmarks for the shell's in-process hot paths, run against a
+   history corpus. Each benchmark builds the same structures the main
+   loop does (arena-backed tokens, pipeline_t, the history ring and its
+   trigram index) and times only the operation under test.
+
+   Usage: bench_micro <corpus> [benchmark] [iterations]
+   Prints one JSON object per benchmark on stdout (JSON Lines). */
+
+#define MYSH_NO_MAIN
+#include "../src/mysh.c"
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char **lines = NULL;
+static size_t nlines = 0, corpus_bytes = 0;
+
+static void load_corpus(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); exit(1); }
+    size_t cap = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t r;
+    while ((r = getline(&line, &len, f)) != -1) {
+        if (r > 0 && line[r-1] == '\n') line[--r] = '\0';
+        if (nlines == cap) {
+            cap = cap ? cap * 2 : 256;
+            lines = realloc(lines, cap * sizeof(char *));
+            if (!lines) { perror("realloc"); exit(1); }
+        }
+        lines[nlines++] = strdup_safe(line);
+        corpus_bytes += (size_t)r;
+    }
+    free(line);
+    fclose(f);
+    if (nlines == 0) { fprintf(stderr, "empty corpus\n"); exit(1); }
+}
+
+static void report(const char *name, double ops, double elapsed_ns, const char *extra) {
+    printf("{\"benchmark\": \"%s\", \"ops\": %.0f, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f%s%s}\n",
+           name, ops, elapsed_ns / ops, ops / (elapsed_ns / 1e9), extra ? ", " : "", extra ? extra : "");
+    fflush(stdout);
+}
+
+/* lex + $VAR expansion into an argv array, no pipeline structure */
+static void bench_tokenize(int iterations) {
+    long tokens = 0;
+    double t0 = now_ns();
+    for (int it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < nlines; i++) {
+            arena_reset(&line_arena);
+            int n;
+            tokenize(lines[i], &n);
+            tokens += n;
+        }
+    }
+    char extra[128];
+    snprintf(extra, sizeof(extra), "\"lines\": %zu, \"tokens_per_line\": %.2f", nlines, (double)tokens / ((double)nlines * iterations));
+    report("tokenize", (double)nlines * iterations, now_ns() - t0, extra);
+}
+
+static void bench_parser(int iterations) {
+    long stages = 0;
+    double t0 = now_ns();
+    for (int it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < nlines; i++) {
+            arena_reset(&line_arena);
+            pipeline_t pl;
+            if (parse_line(lines[i], &pl) == 0) stages += pl.ncmds;
+        }
+    }
+    double elapsed = now_ns() - t0;
+    char extra[160];
+    snprintf(extra, sizeof(extra), "\"lines\": %zu, \"bytes\": %zu, \"stages\": %ld, \"mb_per_sec\": %.1f",
+             nlines, corpus_bytes, stages / iterations, (double)corpus_bytes * iterations / (elapsed / 1e9) / 1e6);
+    report("parser", (double)nlines * iterations, elapsed, extra);
+}
+
+/* Lines dense in $NAME references, half of which are unset */
+static void bench_var_expand(int iterations) {
+    static const char *var_lines[] = {
+        "echo $HOME $USER $SHELL_LEVEL $UNSET_ONE",
+        "cp $SRC/$NAME.tar.gz $DEST/$NAME-$VERSION.tar.gz",
+        "printf '%s\\n' \"$PROJECT_ROOT/build/$TARGET\" $MISSING",
+        "ssh $REMOTE_USER@$REMOTE_HOST -p $REMOTE_PORT",
+    };
+    set_shell_var("SRC", "/srv/src");
+    set_shell_var("NAME", "cyber-shell");
+    set_shell_var("DEST", "/srv/dist");
+    set_shell_var("VERSION", "1.4.2");
+    set_shell_var("PROJECT_ROOT", "/home/bench/projects/cyber-shell");
+    set_shell_var("TARGET", "mysh");
+    set_shell_var("REMOTE_USER", "deploy");
+    set_shell_var("REMOTE_HOST", "build01.example.net");
+    size_t n = sizeof(var_lines) / sizeof(var_lines[0]);
+    long ops = (long)iterations * 50;
+    double t0 = now_ns();
+    for (long it = 0; it < ops; it++) {
+        arena_reset(&line_arena);
+        int ntok;
+        tokenize(var_lines[it % n], &ntok);
+    }
+    report("var_expand", (double)ops, now_ns() - t0, "\"vars_per_line\": 4");
+}
+
+/* alias_splice with 64 aliases defined, every other command hitting one;
+   hits after the first per alias come from the memoized expansion */
+static void bench_alias_expand(int iterations) {
+    char name[32], value[64];
+    for (int i = 0; i < 64; i++) {
+        snprintf(name, sizeof(name), "al%d", i);
+        snprintf(value, sizeof(value), "ls -la --color=auto /tmp/dir%d", i);
+        add_alias(name, value);
+    }
+    char hit[64][8], miss[64][16];
+    for (int i = 0; i < 64; i++) {
+        snprintf(hit[i], sizeof(hit[i]), "al%d", i);
+        snprintf(miss[i], sizeof(miss[i]), "pattern%d", i);
+    }
+    long ops = (long)iterations * 50;
+    double t0 = now_ns();
+    for (long it = 0; it < ops; it++) {
+        arena_reset(&line_arena);
+        int argc;
+        if (it & 1) {
+            char *argv[] = { hit[it % 64], "-h", NULL };
+            alias_splice(argv, 2, &argc);
+        } else {
+            char *argv[] = { "grep", "-rn", miss[it % 64], "src", NULL };
+            alias_splice(argv, 4, &argc);
+        }
+    }
+    report("alias_expand", (double)ops, now_ns() - t0, "\"aliases\": 64, \"hit_ratio\": 0.5");
+}
+
+/* Ring insert + trigram index maintenance (no file append) with the
+   default HISTSIZE, so most pushes also evict */
+static void bench_history_push(int iterations) {
+    history_init();
+    long ops = (long)iterations * (long)nlines;
+    double t0 = now_ns();
+    for (long i = 0; i < ops; i++) {
+        const char *l = lines[i % (long)nlines];
+        history_add(strdup_safe(l), strlen(l), true);
+    }
+    char extra[64];
+    snprintf(extra, sizeof(extra), "\"histsize\": %d", history_cap);
+    report("history_push", (double)ops, now_ns() - t0, extra);
+}
+
+/* history_search over a full ring of corpus lines with distinct suffixes */
+static void bench_history_search(int iterations) {
+    static const char *terms[] = { "git", "docker ps", "make -j", "grep", "ssh", "tar -x", "vim src" };
+    size_t nterms = sizeof(terms) / sizeof(terms[0]);
+    history_init();
+    char buf[4096];
+    for (int i = 0; i < history_cap; i++) {
+        int n = snprintf(buf, sizeof(buf), "%s #%d", lines[(size_t)i % nlines], i);
+        history_add(strdup_safe(buf), (size_t)n, true);
+    }
+    long ops = (long)iterations, visited_total = 0, matches = 0;
+    double t0 = now_ns();
+    for (long i = 0; i < ops; i++) {
+        hist_match_t *m;
+        long visited;
+        matches += history_search(terms[i % (long)nterms], (i & 1) ? HS_ICASE : 0, &m, &visited);
+        visited_total += visited;
+        free(m);
+    }
+    char extra[128];
+    snprintf(extra, sizeof(extra), "\"entries\": %d, \"visited_per_query\": %.1f, \"matches_per_query\": %.1f",
+             history_count, (double)visited_total / ops, (double)matches / ops);
+    report("history_search", (double)ops, now_ns() - t0, extra);
+}
+
+/* Tab completion in command position over a large PATH: the first call
+   builds the index, later ones only revalidate and binary-search it */
+static void bench_complete(int iterations) {
+    static const char *prefixes[] = { "g", "gi", "cmd1", "cmd42", "zz", "m" };
+    size_t nprefixes = sizeof(prefixes) / sizeof(prefixes[0]);
+    char root[] = "/tmp/bench_complete.XXXXXX";
+    if (!mkdtemp(root)) { perror("mkdtemp"); exit(1); }
+    char path[4096] = "", dir[4096], file[4200];
+    int ndirs = 8, per_dir = 4000;
+    for (int d = 0; d < ndirs; d++) {
+        snprintf(dir, sizeof(dir), "%s/bin%d", root, d);
+        mkdir(dir, 0755);
+        for (int i = 0; i < per_dir; i++) {
+            snprintf(file, sizeof(file), "%s/cmd%d_%d", dir, i, d);
+            int fd = open(file, O_WRONLY | O_CREAT, 0755);
+            if (fd >= 0) close(fd);
+        }
+        /* an mtime in the current second would make every listing racy */
+        struct timespec old[2] = { { .tv_sec = time(NULL) - 60 }, { .tv_sec = time(NULL) - 60 } };
+        utimensat(AT_FDCWD, dir, old, 0);
+        if (d) strncat(path, ":", sizeof(path) - strlen(path) - 1);
+        strncat(path, dir, sizeof(path) - strlen(path) - 1);
+    }
+    set_shell_var("PATH", path);
+
+    strvec_t c;
+    double t0 = now_ns();
+    complete_candidates("cmd", true, &c);
+    double build_ns = now_ns() - t0;
+
+    long ops = (long)iterations, found = 0;
+    t0 = now_ns();
+    for (long i = 0; i < ops; i++) {
+        arena_reset(&line_arena);
+        found += complete_candidates(prefixes[i % (long)nprefixes], true, &c);
+    }
+    double elapsed = now_ns() - t0;
+    char extra[160];
+    snprintf(extra, sizeof(extra), "\"path_dirs\": %d, \"commands\": %d, \"index_build_ms\": %.2f, \"candidates_per_op\": %.1f",
+             ndirs, cmd_index_count, build_ns / 1e6, (double)found / ops);
+    report("complete", (double)ops, elapsed, extra);
+
+    for (int d = 0; d < ndirs; d++) {
+        for (int i = 0; i < per_dir; i++) {
+            snprintf(file, sizeof(file), "%s/bin%d/cmd%d_%d", root, d, i, d);
+            unlink(file);
+        }
+        snprintf(dir, sizeof(dir), "%s/bin%d", root, d);
+        rmdir(dir);
+    }
+    rmdir(root);
+}
+
+/* Config load from the text file vs the binary snapshot, for a dotfile
+   with many aliases and variables. Each op loads the whole store; the
+   entries are removed again outside the timed region. */
+static void bench_snapshot(int iterations) {
+    char root[] = "/tmp/bench_snapshot.XXXXXX";
+    if (!mkdtemp(root)) { perror("mkdtemp"); exit(1); }
+    setenv("HOME", root, 1);
+    int naliases = 2000, nvars = 1000;
+    char name[64];
+    for (int i = 0; i < naliases; i++) {
+        snprintf(name, sizeof(name), "snap_a%d", i);
+        add_alias(name, lines[(size_t)i % nlines]);
+    }
+    for (int i = 0; i < nvars; i++) {
+        snprintf(name, sizeof(name), "SNAP_V%d", i);
+        set_shell_var(name, lines[(size_t)i % nlines]);
+    }
+    set_shell_var("MYSH_SNAPSHOT", "1");
+    save_persistent_data();
+
+    long ops = iterations / 100 > 0 ? iterations / 100 : 1;
+    double text_ns = 0, snap_ns = 0;
+    for (long i = 0; i < 2 * ops; i++) {
+        bool from_snapshot = i & 1;
+        double t0 = now_ns();
+        if (from_snapshot) snapshot_load();
+        else load_config_text();
+        double dt = now_ns() - t0;
+        if (from_snapshot) snap_ns += dt;
+        else text_ns += dt;
+        /* each mapping stays, as in the shell: interned names point into it */
+        for (int k = 0; k < naliases; k++) {
+            snprintf(name, sizeof(name), "snap_a%d", k);
+            remove_alias(name);
+        }
+        for (int k = 0; k < nvars; k++) {
+            snprintf(name, sizeof(name), "SNAP_V%d", k);
+            unset_shell_var(name);
+        }
+    }
+    char extra[160];
+    snprintf(extra, sizeof(extra), "\"aliases\": %d, \"vars\": %d, \"text_ns_per_load\": %.0f, \"speedup\": %.2f",
+             naliases, nvars, text_ns / ops, text_ns / snap_ns);
+    report("snapshot", (double)ops, snap_ns, extra);
+
+    unlink(get_snapshot_path());
+    unlink(get_config_path());
+    rmdir(root);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <corpus> [tokenize|parser|var_expand|alias_expand|history_push|history_search|complete|snapshot] [iterations]\n", argv[0]);
+        return 2;
+    }
+    const char *only = argc > 2 ? argv[2] : NULL;
+    int iterations = argc > 3 ? atoi(argv[3]) : 2000;
+    load_corpus(argv[1]);
+
+    /* the shell must not pick up the caller's config or write one */
+    interactive = false;
+    /* the corpus references $HOME/$USER/...; keep expansion deterministic */
+    set_shell_var("HOME", "/home/bench");
+    set_shell_var("USER", "bench");
+
+    static const struct { const char *name; void (*fn)(int); int scale; } benches[] = {
+        { "tokenize", bench_tokenize, 1 },
+        { "parser", bench_parser, 1 },
+        { "var_expand", bench_var_expand, 1 },
+        { "alias_expand", bench_alias_expand, 1 },
+        { "history_push", bench_history_push, 1 },
+        { "history_search", bench_history_search, 5 },
+        { "complete", bench_complete, 1 },
+        { "snapshot", bench_snapshot, 1 },
+    };
+    int ran = 0;
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (only && strcmp(only, "all") != 0 && strcmp(only, benches[i].name) != 0) continue;
+        benches[i].fn(iterations * benches[i].scale);
+        ran++;
+    }
+    if (!ran) { fprintf(stderr, "unknown benchmark: %s\n", only); return 2; }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#!/bin/bash
+# Benchmark suite: in-process microbenchmarks (bench/bench_micro) plus
+# end-to-end runs of ./mysh. Prints one JSON document and writes it to
+# $BENCH_OUT (default bench/results.json) for comparison across releases.
+#
+# Knobs: BENCH_CMDS (commands for cmds/sec), BENCH_STARTUPS (startup runs),
+#        BENCH_MB / BENCH_STAGES (cat pipeline size and length),
+#        BENCH_PIPE_SIZES (PIPE_BUF_SIZE values for the cat pipeline),
+#        BENCH_ITER (microbenchmark iterations)
+
+MYSHELL="./mysh"
+MICRO="./bench/bench_micro"
+CORPUS="bench/corpus/history.txt"
+OUT=${BENCH_OUT:-bench/results.json}
+CMDS=${BENCH_CMDS:-2000}
+STARTUPS=${BENCH_STARTUPS:-50}
+MB=${BENCH_MB:-64}
+STAGES=${BENCH_STAGES:-4}
+PIPE_SIZES=${BENCH_PIPE_SIZES:-default 256K 1M}
+ITER=${BENCH_ITER:-2000}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+# fresh HOME: no user config, aliases or history in the measurements
+export HOME="$WORK/home"
+mkdir -p "$HOME"
+
+now_ns() { date +%s%N; }
+
+RESULTS=()
+
+# ----- microbenchmarks -----
+while IFS= read -r line; do
+    RESULTS+=("$line")
+done < <($MICRO "$CORPUS" all "$ITER")
+
+# ----- startup: mysh -c true, no UI -----
+for i in $(seq "$STARTUPS"); do
+    start=$(now_ns)
+    $MYSHELL -c true > /dev/null 2>&1
+    echo $(( $(now_ns) - start ))
+done | sort -n > "$WORK/startup"
+mean=$(awk '{ s += $1 } END { printf "%.3f", s / NR / 1e6 }' "$WORK/startup")
+p50=$(awk -v n="$STARTUPS" 'NR == int((n + 1) / 2) { printf "%.3f", $1 / 1e6 }' "$WORK/startup")
+RESULTS+=("{\"benchmark\": \"startup\", \"runs\": $STARTUPS, \"mean_ms\": $mean, \"p50_ms\": $p50}")
+
+# ----- commands/sec for `true`, per spawn backend -----
+for i in $(seq "$CMDS"); do echo "true"; done > "$WORK/true.sh"
+for backend in posix_spawn fork; do
+    start=$(now_ns)
+    MYSH_SPAWN=$backend $MYSHELL "$WORK/true.sh" > /dev/null 2>&1
+    ns=$(( $(now_ns) - start ))
+    RESULTS+=("$(awk -v b="$backend" -v n="$CMDS" -v ns="$ns" 'BEGIN {
+        printf "{\"benchmark\": \"cmds_per_sec\", \"backend\": \"%s\", \"commands\": %d, \"ms\": %.1f, \"cmds_per_sec\": %.0f}", b, n, ns / 1e6, n / (ns / 1e9) }')")
+done
+
+# ----- N-stage cat pipeline over a large file, per pipe size -----
+# MYSH_SPAWN=fork runs every cat as its own process, so the pipe buffer
+# size decides how often stages switch; the default runs them in-process.
+head -c $(( MB * 1024 * 1024 )) /dev/urandom > "$WORK/blob"
+PIPE="cat $WORK/blob"
+for i in $(seq $(( STAGES - 1 ))); do PIPE="$PIPE | cat"; done
+$MYSHELL -c "$PIPE > /dev/null" > /dev/null 2>&1   # warm the page cache
+for spawn in inproc fork; do
+    for size in $PIPE_SIZES; do
+        [ "$size" = default ] && pbs="" || pbs=$size
+        [ "$spawn" = fork ] && backend=fork || backend=""
+        start=$(now_ns)
+        MYSH_SPAWN=$backend PIPE_BUF_SIZE=$pbs $MYSHELL -c "$PIPE > /dev/null" > /dev/null 2>&1
+        ns=$(( $(now_ns) - start ))
+        RESULTS+=("$(awk -v mb="$MB" -v st="$STAGES" -v ns="$ns" -v sp="$spawn" -v sz="$size" 'BEGIN {
+            printf "{\"benchmark\": \"cat_pipeline\", \"stages\": %d, \"spawn\": \"%s\", \"pipe_buf_size\": \"%s\", \"mb\": %d, \"ms\": %.1f, \"mb_per_sec\": %.1f}", st, sp, sz, mb, ns / 1e6, mb / (ns / 1e9) }')")
+    done
+done
+
+# ----- assemble -----
+{
+    printf '{\n  "suite": "mysh",\n  "revision": "%s",\n  "date": "%s",\n  "results": [\n' \
+        "$(git rev-parse --short HEAD 2>/dev/null || echo unknown)" "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+    for i in "${!RESULTS[@]}"; do
+        sep=","
+        [ "$i" -eq $(( ${#RESULTS[@]} - 1 )) ] && sep=""
+        printf '    %s%s\n' "${RESULTS[$i]}" "$sep"
+    done
+    printf '  ]\n}\n'
+} | tee "$OUT"
@@ -57,6 +57,13 @@ run_mysh "echo hello | grep h"; print_result $? "Simple pipe"
 run_mysh "echo hello world | grep hello | wc -l"; print_result $? "Multiple pipes"
 run_mysh "ls -la | head -5"; print_result $? "Pipe with arguments"
 
+LONG_PIPE="echo deep"
+for i in $(seq 40); do LONG_PIPE="$LONG_PIPE | cat"; done
+[ "$($MYSHELL -c "$LONG_PIPE" 2>&1)" = "deep" ]; print_result $? "Pipeline longer than 16 stages"
+[ "$($MYSHELL -c "echo $(seq 20000 | tr '\n' ' ') | wc -w" 2>&1)" = "20000" ]; print_result $? "Command with 20000 arguments"
+LONG_WORD=$(head -c 100000 /dev/zero | tr '\0' x)
+[ "$($MYSHELL -c "echo '$LONG_WORD' | wc -c" 2>&1)" = "100001" ]; print_result $? "100 KB word is not truncated"
+
 # ===== REDIRECTION TESTS =====
 echo -e "\n${CYAN}=== REDIRECTION TESTS ===${NC}"
 
@@ -76,16 +83,71 @@ run_mysh "echo 'hello world'"; print_result $? "Single quotes"
 run_mysh "echo \"hello world\""; print_result $? "Double quotes"
 run_mysh "echo hello\ world"; print_result $? "Escaped space"
 
+[ "$($MYSHELL -c "echo '>' \"|\" x" 2>&1)" = "> | x" ]; print_result $? "Quoted operators are plain words"
+$MYSHELL -c "echo glued>glued.txt"; [ "$(cat glued.txt 2>/dev/null)" = "glued" ]; print_result $? "Operators glued to words (echo x>file)"
+rm -f glued.txt
+[ "$($MYSHELL -c "echo 'no \$HOME here'" 2>&1)" = 'no $HOME here' ]; print_result $? "No expansion inside single quotes"
+
+# ===== GLOB TESTS =====
+echo -e "\n${CYAN}=== GLOB TESTS ===${NC}"
+
+MYSH_ABS=$(cd "$(dirname $MYSHELL)" && pwd)/$(basename $MYSHELL)
+GLOB_DIR=$(mktemp -d)
+mkdir -p $GLOB_DIR/a/b $GLOB_DIR/.hid
+touch $GLOB_DIR/x.log $GLOB_DIR/y.log $GLOB_DIR/z.txt $GLOB_DIR/.dot.log $GLOB_DIR/a/top.log $GLOB_DIR/a/b/deep.log
+[ "$(cd $GLOB_DIR && $MYSH_ABS -c 'echo *.log ?.txt' 2>&1)" = "x.log y.log z.txt" ]; print_result $? "Glob * and ? (hidden files skipped)"
+[ "$(cd $GLOB_DIR && $MYSH_ABS -c 'echo [xz].* [!x].log' 2>&1)" = "x.log z.txt y.log" ]; print_result $? "Glob bracket classes"
+[ "$(cd $GLOB_DIR && $MYSH_ABS -c 'echo **/*.log' 2>&1)" = "a/b/deep.log a/top.log x.log y.log" ]; print_result $? "Recursive ** glob"
+[ "$(cd $GLOB_DIR && $MYSH_ABS -c "echo '*.log' \"?.txt\" \\*.log none*" 2>&1)" = "*.log ?.txt *.log none*" ]; print_result $? "Quoted and unmatched patterns stay literal"
+[ "$(cd $GLOB_DIR && printf 'echo *.new\ntouch b.new\necho *.new\n' | $MYSH_ABS 2>&1 | grep -v CREATED | tail -1)" = "b.new" ]; print_result $? "Directory cache sees new files"
+rm -rf $GLOB_DIR
+
 # ===== BACKGROUND JOBS TESTS =====
 echo -e "\n${CYAN}=== BACKGROUND JOBS TESTS ===${NC}"
 
 run_mysh "sleep 1 &"; print_result $? "Background job"
 run_mysh "sleep 1 &\njobs"; print_result $? "jobs command"
 
+NOTICES=$( (for i in $(seq 40); do echo "true &"; done; echo "sleep 0.5"; echo "echo done") | $MYSHELL 2>&1 | grep -c "JOB COMPLETED")
+[ "$NOTICES" -eq 40 ]; print_result $? "Every background completion is reported once (${NOTICES}/40)"
+
+OUT=$(printf 'true | sleep 0.6 &\nsleep 0.2\njobs\n' | $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "\[1\] Running" && ! echo "$OUT" | grep -q "JOB COMPLETED"; print_result $? "Background pipeline runs until its last member exits"
+
+RUNNING=$( (for i in $(seq 150); do echo "sleep 1 &"; done; echo "jobs") | $MYSHELL 2>&1 | grep -c "Running")
+[ "$RUNNING" -eq 150 ]; print_result $? "More than 128 background jobs (${RUNNING}/150)"
+
+OUT=$(echo 'parallel -j 3 sh -c "exit {}" ::: 0 0 4 0' | $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+[ "$(echo "$OUT" | grep -c "│ #")" -eq 4 ] && echo "$OUT" | grep -q "4 │.*sh -c exit 4" && echo "$OUT" | grep -q "4 jobs, 1 failed, 3 slots"; print_result $? "parallel reports per-job status"
+
+START=$(date +%s%N)
+echo 'parallel -j 4 sleep ::: 0.3 0.3 0.3 0.3' | $MYSHELL > /dev/null 2>&1
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+[ "$ELAPSED_MS" -lt 900 ]; print_result $? "parallel keeps N jobs in flight (${ELAPSED_MS}ms)"
+
+printf 'one\ntwo\nthree\nfour\nfive\n' > coproc_in.txt
+OUT=$(printf 'coproc -n 2 up sed -u "s/.*/<&>/"\ncoproc send up hi there\ncoproc feed up coproc_in.txt\ncoproc\ncoproc stop up\ncoproc send up x\n' | $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+[ "$(echo "$OUT" | grep '^<' | tr '\n' ' ')" = "<hi there> <one> <two> <three> <four> <five> " ] && echo "$OUT" | grep -q "│ up .*2x sed.*6 served, up" && echo "$OUT" | grep -q "up stopped after 6 requests" && echo "$OUT" | grep -q "no such coprocess"; print_result $? "coproc pool answers lines in order"
+OUT=$(printf 'coproc cat_w cat\ncat coproc_in.txt | coproc feed cat_w\necho after\n' | $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+[ "$(echo "$OUT" | tail -n6 | tr '\n' ' ')" = "one two three four five after " ]; print_result $? "coproc feed reads a pipeline stage's stdin"
+rm -f coproc_in.txt
+
 # ===== ALIAS TESTS =====
 echo -e "\n${CYAN}=== ALIAS TESTS ===${NC}"
 
-run_mysh "alias hi='echo hey'"; run_mysh "hi"; print_result $? "Alias expansion"
+ALIAS_HOME=$(mktemp -d)
+printf 'alias hi echo hey\nhi\n' | HOME="$ALIAS_HOME" $MYSHELL 2>&1 | grep -qx "hey"; print_result $? "Alias expansion"
+ALIAS_SCRIPT="$ALIAS_HOME/aliases.sh"
+for i in $(seq 1 150); do echo "alias a$i echo v$i"; done > "$ALIAS_SCRIPT"
+echo "unalias a75" >> "$ALIAS_SCRIPT"
+echo "a150" >> "$ALIAS_SCRIPT"
+HOME="$ALIAS_HOME" $MYSHELL "$ALIAS_SCRIPT" 2>&1 | sed 's/\x1b\[[0-9;]*m//g' | grep -qx "v150"; print_result $? "More than 100 aliases"
+HOME="$ALIAS_HOME" $MYSHELL -c "aliases" 2>&1 | sed 's/\x1b\[[0-9;]*m//g' | grep -A1 " a74 " | grep -q " a76 "; print_result $? "Aliases listed in insertion order after unalias"
+OUT=$(printf 'alias e1 echo one\nalias e2 e1 two\ne2 three\nalias e1 echo ONE\ne2\n' | HOME="$ALIAS_HOME" $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -qx "one two three" && echo "$OUT" | grep -qx "ONE two"; print_result $? "Recursive aliases, re-expanded after a redefinition"
+OUT=$(printf "alias echo echo X\necho hi '\$HOME'\nalias ca cb\nalias cb ca\nca\n" | HOME="$ALIAS_HOME" $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -qx 'X hi \$HOME' && echo "$OUT" | grep -q "command not found: ca"; print_result $? "Self-referencing and cyclic aliases terminate"
+rm -rf "$ALIAS_HOME"
 
 # ===== ENVIRONMENT TESTS =====
 echo -e "\n${CYAN}=== ENVIRONMENT TESTS ===${NC}"
@@ -96,14 +158,244 @@ run_mysh "cd $HOME"; print_result $? "Home directory expansion"
 # ===== ERROR HANDLING TESTS =====
 echo -e "\n${CYAN}=== ERROR HANDLING TESTS ===${NC}"
 
-run_mysh "invalid_command_xyz"; print_result $? "Invalid command handling"
-run_mysh "thisdoesnotexist"; print_result $? "Command not found"
+run_mysh "invalid_command_xyz\necho still-alive"; print_result $? "Invalid command handling"
+run_mysh "thisdoesnotexist"; [ $? -eq 127 ]; print_result $? "Command not found"
 
-run_mysh "touch noperms && chmod 000 noperms && cat noperms"
+run_mysh "touch noperms && chmod 000 noperms && cat noperms\necho still-alive"
 PERMRESULT=$?
 chmod 644 noperms && rm noperms
 print_result $PERMRESULT "Permission denied"
 
+# ===== COMMAND LIST TESTS =====
+echo -e "\n${CYAN}=== COMMAND LIST TESTS ===${NC}"
+
+[ "$($MYSHELL -c 'false && echo no || echo yes; echo after' 2>&1)" = "$(printf 'yes\nafter')" ]; print_result $? "&& || ; short-circuit left to right"
+$MYSHELL -c 'true; sh -c "exit 3" | true; sh -c "exit 4"' > /dev/null 2>&1; [ $? -eq 4 ] && ! $MYSHELL -c 'false' > /dev/null 2>&1; print_result $? "Exit status of the last pipeline propagates"
+LIST_DIR=$(mktemp -d)
+OUT=$($MYSHELL -c "cd $LIST_DIR && touch g1.txt && set N 5; echo *.txt \$N; echo 'a && b' \"c;d\"" 2>&1 | sed 's/\x1b\[[0-9;]*m//g' | grep -v "CREATED\|VARIABLE SET")
+[ "$OUT" = "$(printf 'g1.txt 5\na && b c;d')" ]; print_result $? "Later commands see earlier builtins and files; quoted operators stay words"
+rm -rf "$LIST_DIR"
+OUT=$($MYSHELL -c 'echo x | cat > /nonexistent/x && echo ok; cat < /nonexistent/y && echo ok2' 2>&1)
+! echo "$OUT" | grep -q "^ok"; print_result $? "A cat stage whose redirection fails stops &&"
+OUT=$($MYSHELL -c 'echo a && && echo b' 2>&1); STATUS=$?
+[ $STATUS -eq 2 ] && echo "$OUT" | grep -q "syntax error" && ! echo "$OUT" | grep -qx "a"; print_result $? "Missing command after && is a syntax error"
+
+OUT=$(printf 'false; echo $?\nsh -c "exit 3" | sh -c "exit 5" | true\necho $PIPESTATUS / $PIPESTATUS_2 / $?\nnope\necho "st=$?"\n' | $MYSHELL 2>&1)
+[ "$(echo "$OUT" | grep -v 'command not found')" = "$(printf '1\n3 5 0 / 5 / 0\nst=127')" ]; print_result $? "\$? and PIPESTATUS report every stage"
+OUT=$(printf 'sh -c "sleep 0.2; exit 2" | sh -c "sleep 0.2; exit 3" &\nfg 1\necho "st=$? ps=$PIPESTATUS"\n' | $MYSHELL 2>&1)
+echo "$OUT" | grep -q "^st=3 ps=2 3$"; print_result $? "fg sets \$? and PIPESTATUS from the job"
+
+# ===== COMMAND HASH TESTS =====
+echo -e "\n${CYAN}=== COMMAND HASH TESTS ===${NC}"
+
+$MYSHELL -c "$(printf 'ls > /dev/null\nhash -l')" 2>&1 | grep -q "/ls"; print_result $? "hash -l lists looked-up commands"
+! $MYSHELL -c "$(printf 'ls > /dev/null\nhash -r\nhash -l')" 2>&1 | grep -q "/ls"; print_result $? "hash -r clears the table"
+$MYSHELL -c "$(printf 'set PATH /nonexistent\nls\nunset PATH')" 2>&1 | grep -q "command not found"; print_result $? "set PATH invalidates hashed paths"
+
+# ===== SPAWN BACKEND TESTS =====
+echo -e "\n${CYAN}=== SPAWN BACKEND TESTS ===${NC}"
+
+[ "$($MYSHELL -c 'echo spawn | tr a-z A-Z' 2>&1)" = "SPAWN" ]; print_result $? "posix_spawn pipeline"
+[ "$(MYSH_SPAWN=fork $MYSHELL -c 'echo forked | tr a-z A-Z' 2>&1)" = "FORKED" ]; print_result $? "MYSH_SPAWN=fork pipeline"
+$MYSHELL -c 'cat < /nonexistent_file' 2>&1 | grep -q "open infile"; print_result $? "posix_spawn reports redirection errors"
+
+TRACE_FILE=$(mktemp)
+N=$(MYSH_TRACE=$TRACE_FILE $MYSHELL -c 'help | wc -l' 2>&1)
+[ "$N" -gt 10 ] && grep -q '"name":"builtin".*"detail":"help"' $TRACE_FILE && ! grep -q '"name":"fork"' $TRACE_FILE; print_result $? "Output-only builtin runs in-process inside a pipeline"
+rm -f $TRACE_FILE
+
+BLOB=$(mktemp)
+head -c 3000000 /dev/urandom > $BLOB
+[ "$($MYSHELL -c "cat $BLOB | cat | cat | cksum" 2>&1)" = "$(cksum < $BLOB)" ]; print_result $? "Internal splice cat preserves data through pipes"
+$MYSHELL -c "cat < $BLOB > $BLOB.copy" > /dev/null 2>&1
+cmp -s $BLOB $BLOB.copy; print_result $? "cat between file redirections"
+TRACE_FILE=$(mktemp)
+N=$(MYSH_TRACE=$TRACE_FILE $MYSHELL -c "cat $BLOB | wc -c" 2>&1)
+[ "$N" -eq 3000000 ] && grep -q '"name":"cat_thread"' $TRACE_FILE; print_result $? "cat of a regular file runs in-process next to a child"
+MYSH_TRACE=$TRACE_FILE $MYSHELL -c "cat $BLOB > /dev/null; cat /dev/zero | head -c 1 > /dev/null" > /dev/null 2>&1
+! grep -q '"name":"cat_thread"' $TRACE_FILE; print_result $? "Lone cat and cat of a device run as children that Ctrl-C reaches"
+rm -f $TRACE_FILE
+[ "$($MYSHELL -c 'yes | cat | head -3' 2>&1 | wc -l)" -eq 3 ]; print_result $? "Internal cat stops on a closed reader"
+rm -f $BLOB $BLOB.copy
+
+if command -v python3 > /dev/null; then
+    [ "$(PIPE_BUF_SIZE=1M $MYSHELL -c 'python3 -c "import fcntl; print(fcntl.fcntl(1, 1032))" | cat' 2>&1)" = "1048576" ]
+else
+    true
+fi; print_result $? "PIPE_BUF_SIZE resizes pipeline pipes"
+[ "$($MYSHELL -c 'ls /proc/self/fd | cat | cat' 2>&1 | wc -l)" -le 4 ] && \
+    [ "$(MYSH_SPAWN=fork $MYSHELL -c 'ls /proc/self/fd | cat | cat' 2>&1 | wc -l)" -le 4 ]; print_result $? "Pipeline children inherit no stray pipe fds"
+SET_HOME=$(mktemp -d)
+OUT=$(printf 'set PIPE_BUF_SIZE=256K\nvars\n' | HOME=$SET_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "PIPE_BUF_SIZE = 256K"; print_result $? "set NAME=VALUE syntax"
+rm -rf $SET_HOME
+
+# ===== RESOURCE ACCOUNTING TESTS =====
+echo -e "\n${CYAN}=== RESOURCE ACCOUNTING TESTS ===${NC}"
+
+RU_HOME=$(mktemp -d)
+OUT=$(printf 'sleep 0.2 | cat\nvars\n' | HOME=$RU_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "MYSH_LAST_RUSAGE .*wall=0\.[2-9]" && echo "$OUT" | grep -q "MYSH_LAST_RUSAGE_2 .*maxrss="; print_result $? "MYSH_LAST_RUSAGE per pipeline and stage"
+! grep -q RUSAGE $RU_HOME/.mysh_history_config 2>/dev/null; print_result $? "Rusage variables are not persisted"
+OUT=$(HOME=$RU_HOME $MYSHELL -c 'sleep 0.2; times | cat' 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "sleep  *0\.[2-9][0-9]*s wall" && ! echo "$OUT" | grep -q "│ times "; print_result $? "times in a pipeline reports the pipeline before it"
+rm -rf $RU_HOME
+
+OUT=$(echo "timeit -n 5 'true | cat'" | $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "runs  *5 " && echo "$OUT" | grep -q "p50 .* ms" && echo "$OUT" | grep -q "p99 .* ms"; print_result $? "timeit reports mean/p50/p99"
+
+TRACE_FILE=$(mktemp)
+printf 'ls | wc -l\n' | MYSH_TRACE=$TRACE_FILE $MYSHELL > /dev/null 2>&1
+[ "$(head -c1 $TRACE_FILE)" = "[" ] && [ "$(tail -n1 $TRACE_FILE)" = "]" ] && grep -q '"name":"parse".*"ph":"X"' $TRACE_FILE && [ "$(grep -c '"name":"posix_spawn"' $TRACE_FILE)" -eq 2 ]; print_result $? "MYSH_TRACE writes Chrome trace events"
+printf 'trace on %s\necho traced\ntrace off\necho untraced\n' $TRACE_FILE | $MYSHELL > /dev/null 2>&1
+grep -q '"detail":"echo traced"' $TRACE_FILE && ! grep -q 'untraced' $TRACE_FILE; print_result $? "trace on/off builtin"
+rm -f $TRACE_FILE
+
+# ===== SCRIPT MODE TESTS =====
+echo -e "\n${CYAN}=== SCRIPT MODE TESTS ===${NC}"
+
+[ "$($MYSHELL -c 'echo scripted' 2>&1)" = "scripted" ]; print_result $? "-c runs without header or loading bars"
+
+printf '#!/usr/bin/env mysh\necho one\n# comment\necho two\n' > script1.sh
+[ "$($MYSHELL script1.sh 2>&1)" = "$(printf 'one\ntwo')" ]; print_result $? "Script file argument"
+rm -f script1.sh
+
+[ "$(echo 'echo piped' | $MYSHELL 2>&1)" = "piped" ]; print_result $? "Non-tty stdin selects script mode"
+
+printf 'echo one\nalias zz=ls < /dev/null\necho two\n' > script2.sh
+[ "$($MYSHELL script2.sh 2>&1 | grep -v ERROR)" = "$(printf 'one\ntwo')" ]; print_result $? "Forked built-in does not rewind the script"
+rm -f script2.sh
+
+OUT=$($MYSHELL --startup-profile -c 'echo profiled' 2>&1)
+echo "$OUT" | grep -q "│ config  *[0-9.]* ms" && echo "$OUT" | grep -q "│ history load " && [ "$(echo "$OUT" | tail -n1)" = "profiled" ]; print_result $? "--startup-profile reports phases before the first line"
+
+START=$(date +%s%N)
+for i in $(seq 20); do echo true; done | $MYSHELL > /dev/null 2>&1
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+[ "$ELAPSED_MS" -lt 3000 ]; print_result $? "Batch of 20 commands has no cosmetic delays (${ELAPSED_MS}ms)"
+
+# ===== HISTORY TESTS =====
+echo -e "\n${CYAN}=== HISTORY TESTS ===${NC}"
+
+HIST_HOME=$(mktemp -d)
+printf 'echo a1\n' | HOME=$HIST_HOME $MYSHELL > /dev/null 2>&1
+printf 'echo b1\n' | HOME=$HIST_HOME $MYSHELL > /dev/null 2>&1
+printf 'echo a2\n' | HOME=$HIST_HOME $MYSHELL > /dev/null 2>&1
+[ "$(cat $HIST_HOME/.mysh_history)" = "$(printf 'echo a1\necho b1\necho a2')" ]; print_result $? "History appended per command across shells"
+
+rm -f $HIST_HOME/.mysh_history
+printf 'set HISTSIZE 3\n' | HOME=$HIST_HOME $MYSHELL > /dev/null 2>&1
+for i in $(seq 10); do echo "echo h$i"; done | HOME=$HIST_HOME $MYSHELL > /dev/null 2>&1
+[ "$(tail -n1 $HIST_HOME/.mysh_history)" = "echo h10" ] && [ "$(wc -l < $HIST_HOME/.mysh_history)" -le 6 ]; print_result $? "History file compacted to HISTSIZE"
+
+rm -f $HIST_HOME/.mysh_history_config
+seq -f 'echo big%g' 300000 > $HIST_HOME/.mysh_history
+OUT=$(echo 'history' | HOME=$HIST_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "echo big300000" && ! echo "$OUT" | grep -q "echo big1 "; print_result $? "Large history file loads its most recent entries"
+OUT=$(printf '!999\n' | HOME=$HIST_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "^big300000$"; print_result $? "!N sees the background-loaded history"
+seq -f 'echo small%g' 100 > $HIST_HOME/.mysh_history
+printf 'truncate -s 0 %s\nhistory\n' $HIST_HOME/.mysh_history | HOME=$HIST_HOME $MYSHELL 2>&1 | grep -q "echo small99"; print_result $? "History survives the file being truncated underneath it"
+
+printf 'git push\nls\ngit push\nls\ngit push\ngit pull\n' > $HIST_HOME/.mysh_history
+OUT=$(echo 'histsearch git pu' | HOME=$HIST_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g' | grep -o '│ git pu[a-z]*')
+[ "$OUT" = "$(printf '│ git push\n│ git pull')" ]; print_result $? "histsearch ranks frequent entries first and folds duplicates"
+
+OUT=$(echo 'histsearch -i -p -t GIT PULL' | HOME=$HIST_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+echo "$OUT" | grep -q "│ git pull" && ! echo "$OUT" | grep -q "│ histsearch" && echo "$OUT" | grep -q "ms$"; print_result $? "histsearch -i -p -t"
+rm -rf $HIST_HOME
+
+# ===== CACHE TESTS =====
+echo -e "\n${CYAN}=== CACHE TESTS ===${NC}"
+
+CACHE_HOME=$(mktemp -d)
+CMD="cache sh -c 'date +%s%N; echo to-stderr >&2; exit 3'"
+A=$(HOME=$CACHE_HOME $MYSHELL -c "$CMD" 2>&1)
+START=$(date +%s%N)
+B=$(printf '%s\n%s\n' "$CMD" "$CMD" | HOME=$CACHE_HOME $MYSHELL 2>&1)
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+[ "$B" = "$(printf '%s\n%s' "$A" "$A")" ] && echo "$A" | grep -q "^to-stderr$" && [ -n "$(ls $CACHE_HOME/.mysh_cache)" ]; print_result $? "cache replays stdout and stderr from the store in a new shell (${ELAPSED_MS}ms)"
+
+OUT=$(printf 'echo one > w.txt\ncache --watch w.txt cat w.txt\ncache --watch w.txt cat w.txt\necho two > w.txt\ncache --watch w.txt cat w.txt\ncache --ttl 1 date +%%s%%N\nsleep 1.1\ncache --ttl 1 date +%%s%%N\ncache --clear\n' | HOME=$CACHE_HOME $MYSHELL 2>&1 | sed 's/\x1b\[[0-9;]*m//g')
+[ "$(echo "$OUT" | head -n3 | tr '\n' ' ')" = "one one two " ] && [ "$(echo "$OUT" | sed -n 4p)" != "$(echo "$OUT" | sed -n 5p)" ] && echo "$OUT" | grep -q "cleared" && [ -z "$(ls $CACHE_HOME/.mysh_cache)" ]; print_result $? "cache reruns when a watched file changes or the TTL expires"
+rm -rf $CACHE_HOME w.txt
+
+# ===== SNAPSHOT TESTS =====
+echo -e "\n${CYAN}=== SNAPSHOT TESTS ===${NC}"
+
+SNAP_HOME=$(mktemp -d)
+printf 'set MYSH_SNAPSHOT 1\nalias greet echo snap-hello\necho first\n' | HOME=$SNAP_HOME $MYSHELL > /dev/null 2>&1
+OUT=$(HOME=$SNAP_HOME $MYSHELL --startup-profile -c 'greet' 2>&1)
+[ "$(head -c 8 $SNAP_HOME/.mysh_snapshot 2>/dev/null)" = "MYSHSNAP" ] && echo "$OUT" | grep -q "config (snapshot)" && echo "$OUT" | grep -q "from snapshot" && [ "$(echo "$OUT" | tail -n1)" = "snap-hello" ]; print_result $? "Snapshot restores aliases and history"
+sed -i 's/snap-hello/text-hello/' $SNAP_HOME/.mysh_history_config
+[ "$(echo greet | HOME=$SNAP_HOME $MYSHELL 2>&1)" = "text-hello" ]; print_result $? "Edited text config takes precedence over the snapshot"
+head -c 100 $SNAP_HOME/.mysh_snapshot > $SNAP_HOME/snap.tmp && mv $SNAP_HOME/snap.tmp $SNAP_HOME/.mysh_snapshot
+[ "$(echo greet | HOME=$SNAP_HOME $MYSHELL 2>&1)" = "text-hello" ]; print_result $? "Truncated snapshot falls back to the text files"
+{ echo 'echo own-line'; sleep 0.5; } | HOME=$SNAP_HOME $MYSHELL > /dev/null 2>&1 &
+sleep 0.2; echo 'echo other-line' | HOME=$SNAP_HOME $MYSHELL > /dev/null 2>&1; wait
+HOME=$SNAP_HOME $MYSHELL -c 'history' 2>&1 | grep -q "other-line"; print_result $? "Snapshot does not drop another shell's history lines"
+echo 'unset MYSH_SNAPSHOT' | HOME=$SNAP_HOME $MYSHELL > /dev/null 2>&1
+[ ! -e $SNAP_HOME/.mysh_snapshot ]; print_result $? "Unsetting MYSH_SNAPSHOT removes the snapshot"
+rm -rf $SNAP_HOME
+
+# ===== OUTPUT TESTS =====
+echo -e "\n${CYAN}=== OUTPUT TESTS ===${NC}"
+
+OUT_HOME=$(mktemp -d)
+seq -f 'echo row%g' 5000 > $OUT_HOME/.mysh_history
+OUT=$(printf 'history\nhelp\nset X 1\n' | HOME=$OUT_HOME $MYSHELL 2>&1)
+! echo "$OUT" | grep -q $'\x1b'; print_result $? "No colour escapes when stdout is not a terminal"
+[ "$(echo "$OUT" | grep -c '│ *[0-9]* │ echo row')" -eq 999 ] && echo "$OUT" | grep -q "│  999 │ echo row5000 "; print_result $? "Buffered history table keeps every row in order"
+rm -rf $OUT_HOME
+
+# ===== LINE EDITOR TESTS =====
+echo -e "\n${CYAN}=== LINE EDITOR TESTS ===${NC}"
+
+# drive an interactive shell through a pty: each argument is one burst of keys
+pty_session() {
+    python3 - "$@" <<'PY'
+import os, pty, select, sys, time
+home, shell = sys.argv[1], sys.argv[2]
+pid, fd = pty.fork()
+if pid == 0:
+    os.environ.update(HOME=home, TERM="xterm")
+    os.execv(shell, [shell])
+out = b""
+def drain(t):
+    global out
+    end = time.time() + t
+    while time.time() < end:
+        if select.select([fd], [], [], 0.05)[0]:
+            try: d = os.read(fd, 65536)
+            except OSError: return
+            if not d: return
+            out += d
+drain(3)
+for keys in sys.argv[3:]:
+    os.write(fd, keys.encode().decode("unicode_escape").encode("latin1"))
+    drain(1)
+os.kill(pid, 9)
+sys.stdout.write(out.decode("utf-8", "replace"))
+PY
+}
+
+if command -v python3 > /dev/null; then
+    ED_HOME=$(mktemp -d)
+    OUT=$(pty_session $ED_HOME $MYSH_ABS 'ech' '\t' 'edited\r' 'echo one\r' '\x1b[A\x01\x1b[C\x1b[C\x1b[C\x1b[C\x1b[CX\r' 'echo dropped\x15echo kept\r' | sed 's/\x1b\[[0-9;]*[A-Za-z]//g' | tr -d '\r')
+    echo "$OUT" | grep -qx "edited"; print_result $? "Tab completes a command name"
+    echo "$OUT" | grep -qx "Xone"; print_result $? "History recall and cursor movement"
+    echo "$OUT" | grep -qx "kept" && ! echo "$OUT" | grep -qx "dropped"; print_result $? "Ctrl-U kills to the start of the line"
+    OUT=$(pty_session $ED_HOME $MYSH_ABS 'true; ech' '\t' 'semi\r' 'false || ech' '\t' 'oror\r' '' | sed 's/\x1b\[[0-9;]*[A-Za-z]//g' | tr -d '\r')
+    echo "$OUT" | grep -qx "semi" && echo "$OUT" | grep -qx "oror"; print_result $? "Tab completes a command name after ; and ||"
+    OUT=$(pty_session $ED_HOME $MYSH_ABS 'sleep 0.2 &\r' 'ec' 'ho mid\r' | sed 's/\x1b\[[0-9;]*[A-Za-z]//g' | tr -d '\r')
+    echo "$OUT" | awk '/JOB COMPLETED/ && !n { n = NR } /^mid$/ { m = NR } END { exit !(n && m > n) }'; print_result $? "Background completion is reported while a line is being edited"
+    OUT=$(pty_session $ED_HOME $MYSH_ABS 'false\r' | sed 's/\x1b\[[0-9;]*[A-Za-z]//g' | tr -d '\r')
+    [ "$(echo "$OUT" | grep -c '\[✗\]')" -eq 1 ] && echo "$OUT" | grep -q '\[✓\]'; print_result $? "Prompt shows a failed command"
+    OUT=$(NO_COLOR=1 pty_session $ED_HOME $MYSH_ABS 'help\r')
+    echo "$OUT" | grep -q "CORE COMMANDS" && ! echo "$OUT" | grep -q $'\x1b\[[0-9;]*m'; print_result $? "NO_COLOR drops colour on a terminal"
+    rm -rf $ED_HOME
+fi
+
 # ===== SUMMARY =====
 echo -e "\n${CYAN}=== SUMMARY ===${NC}"
 echo -e "${BLUE}Tests run: $((TESTS_PASSED + TESTS_FAILED))${NC}"
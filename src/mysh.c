@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #define _XOPEN_SOURCE 700
 
@@ -5,14 +6,28 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
@@ -21,14 +36,9 @@
 
 /* -------------------- Config -------------------- */
 
-#define MAX_TOKENS 256
-#define MAX_ARGS 128
 #define MAX_HISTORY 1000
 #define HISTORY_FILE ".mysh_history"
-#define MAX_JOBS 128
-#define PROMPT_BUF 1024
-#define MAX_ALIASES 100
-#define MAX_VARS 100
+#define PROMPT_BUF 2048
 #define MAX_SUGGESTIONS 10
 
 /* ---------- Cyberpunk Colors ---------- */
@@ -64,39 +74,118 @@ typedef struct {
     pid_t pgid;
     char *cmdline;
     job_state_t state;
+    int nprocs;         /* members not yet reaped; JOB_DONE at zero */
+    pid_t last_pid;     /* last pipeline stage; its status is the job's */
+    int status;         /* exit status (128+sig if killed), once done */
+    bool quiet;         /* no start/finish notices (parallel) */
+    struct timespec started, finished;
+    int nstages;
+    pid_t *stage_pids;  /* per stage: its child until reaped, else 0 */
+    int *stage_status;  /* per stage, as in PIPESTATUS */
 } job_t;
 
-/* Jobs */
-static job_t jobs[MAX_JOBS];
+/* Jobs (heap-allocated so pid_jobs can point at them) */
+static job_t **jobs = NULL;
 static int jobs_count = 0;
+static int jobs_cap = 0;
 static int next_job_id = 1;
+/* Jobs in JOB_RUNNING, maintained on every state transition (prompt [bg:N]) */
+static int running_jobs = 0;
+/* Completion notices queued by reap_children, printed before the prompt */
+static int *job_notices = NULL;
+static int job_notice_count = 0;
+static int job_notice_cap = 0;
+/* Resource usage of the last foreground pipeline (wait4) */
+typedef struct {
+    double wall, user, sys;     /* seconds */
+    long maxrss;                /* KiB; max over stages for a pipeline */
+    long nvcsw, nivcsw;
+} usage_t;
 
-/* History */
-static char *history[MAX_HISTORY];
+typedef struct {
+    usage_t total;
+    usage_t *stages;            /* grown to the longest pipeline seen */
+    char (*names)[32];
+    int nstages, cap;
+    int published;              /* per-stage variables currently set */
+    bool valid;
+    bool running;               /* between usage_begin and its end */
+    struct timespec started;
+} usage_record_t;
+
+/* prev_usage is the pipeline before last_usage: what a `times` stage
+   reports, since its own pipeline has already started recording */
+static usage_record_t last_usage, prev_usage;
+
+/* Job started by the most recent background pipeline */
+static job_t *last_bg_job = NULL;
+/* Status of the last pipeline: $?, the prompt's ✓/✗, a script's exit */
+static int last_status = 0;
+/* Set by a builtin that published PIPESTATUS itself (fg) */
+static bool builtin_pipestatus = false;
+/* SIGCHLD stays blocked and is read from this signalfd instead */
+static int sigchld_fd = -1;
+
+/* History: ring buffer of the newest history_cap entries (HISTSIZE).
+   Entries loaded at startup point into one buffer copied out of the file
+   (or into the snapshot) and are not NUL-terminated; entries pushed this
+   session are owned. */
+typedef struct {
+    const char *text;
+    size_t len;
+    bool owned;
+} hist_entry_t;
+
+static hist_entry_t *history = NULL;
+static char *history_loaded = NULL;    /* text of the entries read at startup */
+static int history_cap = 0;
+static int history_head = 0;     /* slot of the oldest entry */
 static int history_count = 0;
+static uint32_t history_evicted = 0;  /* seq of entry 0 (entries pushed out so far) */
+static long history_file_lines = 0;  /* lines in the file, for compaction */
+static bool history_file_unterminated = false;  /* last line lacks '\n' */
+/* The file as the ring last saw it (st_ino 0 if there was none), and
+   whether the ring still holds its tail, i.e. no other shell wrote since */
+static struct stat history_file_st;
+static bool history_file_synced = false;
 
 /* Terminal & foreground tracking */
 static struct termios shell_tmodes;
 static pid_t shell_pgid;
 static pid_t fg_pgid = 0;
 
-/* Aliases */
+/* Interactive session: stdin is a tty and no -c/script was given. Script
+   mode drops the header, loading bars, achievements and every sleep_us. */
+static bool interactive = true;
+
+/* Aliases: insertion-ordered for listing, hashed by name (alias_map) */
 typedef struct {
-    char *name;
+    const char *name;   /* interned */
     char *value;
+    bool words_ready;   /* words/nwords reflect value */
+    char **words;       /* value lexed once, interned; NULL: lex per use */
+    int nwords;
+    char **exp;         /* memoized chain expansion (interned words) */
+    int nexp;
+    unsigned exp_epoch; /* exp is valid while this equals alias_epoch */
 } alias_t;
 
-static alias_t aliases[MAX_ALIASES];
+static alias_t **aliases = NULL;
 static int alias_count = 0;
+static int alias_cap = 0;
+static unsigned alias_gen = 0;      /* bumped when the set of names changes */
+static unsigned alias_epoch = 1;    /* bumped on any alias change */
 
-/* Shell variables */
+/* Shell variables: same layout (var_map) */
 typedef struct {
-    char *name;
+    const char *name;   /* interned */
     char *value;
+    bool transient;     /* set by the shell itself, never saved */
 } shell_var_t;
 
-static shell_var_t shell_vars[MAX_VARS];
+static shell_var_t **shell_vars = NULL;
 static int var_count = 0;
+static int var_cap = 0;
 
 /* Mini achievements (UI-only) */
 typedef struct {
@@ -117,12 +206,19 @@ static achievement_t achievements[] = {
 
 /* ---------- Forward declarations ---------- */
 static bool is_builtin(const char *cmd);
-static char *get_history_path(void);
+static const char *get_history_path(void);
+static const hist_entry_t *history_at(int i);
+static void history_ensure(void);
+static bool snap_borrowed(const char *p);
+static char **tokenize(const char *line, int *ntoks_out);
+static int builtin_coproc(int argc, char **argv);
+static int builtin_cache(int argc, char **argv);
+static void publish_pipestatus(const int *st, int n);
 
 /* ---------- Utility helpers ---------- */
 
 static void sleep_us(long usec) {
-    if (usec <= 0) return;
+    if (usec <= 0 || !interactive) return;
     struct timespec ts;
     ts.tv_sec = usec / 1000000L;
     ts.tv_nsec = (usec % 1000000L) * 1000L;
@@ -147,22 +243,435 @@ static char *strdup_safe(const char *s) {
     return r;
 }
 
+/* ---------- String-keyed hash map ---------- */
+/* Open addressing with linear probing over a power-of-two table. Keys are
+   borrowed: the caller keeps them alive for as long as they are mapped. */
+
+typedef struct {
+    const char *key;    /* NULL marks an empty slot */
+    uint32_t hash;
+    void *value;
+} strmap_slot_t;
+
+typedef struct {
+    strmap_slot_t *slots;
+    size_t cap;
+    size_t count;
+} strmap_t;
+
+/* FNV-1a */
+static uint32_t str_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Same hash over a length-delimited buffer */
+static uint32_t mem_hash(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static strmap_slot_t *strmap_slot(const strmap_t *m, const char *key, uint32_t h) {
+    size_t mask = m->cap - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        strmap_slot_t *sl = &m->slots[i];
+        if (!sl->key) return sl;
+        if (sl->hash == h && (sl->key == key || strcmp(sl->key, key) == 0)) return sl;
+    }
+}
+
+static void *strmap_get(const strmap_t *m, const char *key) {
+    if (m->count == 0) return NULL;
+    strmap_slot_t *sl = strmap_slot(m, key, str_hash(key));
+    return sl->key ? sl->value : NULL;
+}
+
+static void strmap_grow(strmap_t *m) {
+    strmap_t bigger = { .cap = m->cap ? m->cap * 2 : 16, .count = m->count };
+    bigger.slots = calloc(bigger.cap, sizeof(strmap_slot_t));
+    if (!bigger.slots) { perror("calloc"); exit(1); }
+    for (size_t i = 0; i < m->cap; i++) {
+        if (m->slots[i].key)
+            *strmap_slot(&bigger, m->slots[i].key, m->slots[i].hash) = m->slots[i];
+    }
+    free(m->slots);
+    *m = bigger;
+}
+
+/* Insert or replace; load factor is kept below 3/4 */
+static void strmap_put(strmap_t *m, const char *key, void *value) {
+    if ((m->count + 1) * 4 > m->cap * 3) strmap_grow(m);
+    uint32_t h = str_hash(key);
+    strmap_slot_t *sl = strmap_slot(m, key, h);
+    if (!sl->key) {
+        sl->key = key;
+        sl->hash = h;
+        m->count++;
+    }
+    sl->value = value;
+}
+
+/* Backward-shift deletion: no tombstones, probe chains stay short */
+static void strmap_del(strmap_t *m, const char *key) {
+    if (m->count == 0) return;
+    strmap_slot_t *sl = strmap_slot(m, key, str_hash(key));
+    if (!sl->key) return;
+
+    size_t mask = m->cap - 1;
+    size_t hole = (size_t)(sl - m->slots);
+    sl->key = NULL;
+    m->count--;
+    for (size_t j = (hole + 1) & mask; m->slots[j].key; j = (j + 1) & mask) {
+        size_t home = m->slots[j].hash & mask;
+        /* the entry may move back unless its home lies in (hole, j] */
+        bool stays = (hole < j) ? (home > hole && home <= j) : (home > hole || home <= j);
+        if (stays) continue;
+        m->slots[hole] = m->slots[j];
+        m->slots[j].key = NULL;
+        hole = j;
+    }
+}
+
+static void strmap_clear(strmap_t *m) {
+    free(m->slots);
+    *m = (strmap_t){0};
+}
+
+/* Intern pool: each distinct alias/variable name is allocated once and then
+   compared by pointer on the hot path. Interned strings are never freed. */
+static strmap_t intern_pool;
+
+static const char *intern(const char *s) {
+    const char *k = strmap_get(&intern_pool, s);
+    if (k) return k;
+    char *copy = strdup_safe(s);
+    strmap_put(&intern_pool, copy, copy);
+    return copy;
+}
+
+/* Like intern, but s itself is pooled; it must live as long as the shell
+   (a string in the snapshot mapping) */
+static const char *intern_keep(const char *s) {
+    const char *k = strmap_get(&intern_pool, s);
+    if (k) return k;
+    strmap_put(&intern_pool, s, (void *)s);
+    return s;
+}
+
+/* Alias and variable values are malloc'd, or borrowed from the snapshot */
+static void release_value(char *value) {
+    if (!snap_borrowed(value)) free(value);
+}
+
+static strmap_t alias_map;
+static strmap_t var_map;
+
+/* Append to a growable pointer array (insertion order of the stores) */
+static void ptr_array_push(void ***arr, int *count, int *cap, void *p) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        void **grown = realloc(*arr, sizeof(void *) * (size_t)*cap);
+        if (!grown) { perror("realloc"); exit(1); }
+        *arr = grown;
+    }
+    (*arr)[(*count)++] = p;
+}
+
+static void ptr_array_remove(void **arr, int *count, void *p) {
+    for (int i = 0; i < *count; i++) {
+        if (arr[i] == p) {
+            memmove(&arr[i], &arr[i + 1], sizeof(void *) * (size_t)(*count - i - 1));
+            (*count)--;
+            return;
+        }
+    }
+}
+
+/* ---------- Per-line arena ---------- */
+/* Bump allocator owning everything derived from one input line: tokens,
+   expansion results, cmd_t argv and redirection targets. The main loop
+   rewinds it once per line; chunks are kept, so steady state does no
+   malloc at all. */
+
+#define ARENA_CHUNK 16384
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t cap;
+    size_t used;
+    max_align_t data[];
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *head;
+    arena_chunk_t *cur;
+} arena_t;
+
+static arena_t line_arena;
+
+static void *arena_alloc(arena_t *a, size_t n) {
+    n = (n + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    while (a->cur && a->cur->used + n > a->cur->cap) {
+        if (!a->cur->next) break;
+        a->cur = a->cur->next;
+        a->cur->used = 0;
+    }
+    if (!a->cur || a->cur->used + n > a->cur->cap) {
+        size_t cap = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+        arena_chunk_t *c = malloc(sizeof(arena_chunk_t) + cap);
+        if (!c) { perror("malloc"); exit(1); }
+        c->cap = cap;
+        c->used = 0;
+        c->next = NULL;
+        /* link after the current chunk so later resets reuse it */
+        if (a->cur) { c->next = a->cur->next; a->cur->next = c; }
+        else a->head = c;
+        a->cur = c;
+    }
+    void *p = (char *)a->cur->data + a->cur->used;
+    a->cur->used += n;
+    return p;
+}
+
+static char *arena_strndup(arena_t *a, const char *s, size_t n) {
+    char *r = arena_alloc(a, n + 1);
+    memcpy(r, s, n);
+    r[n] = '\0';
+    return r;
+}
+
+static char *arena_strdup(arena_t *a, const char *s) {
+    if (!s) return NULL;
+    return arena_strndup(a, s, strlen(s));
+}
+
+/* Resize the most recent allocation in place when it is still at the top
+   of its chunk, otherwise move it. old must be the size it was allocated
+   with. */
+static void *arena_grow(arena_t *a, void *p, size_t old, size_t n) {
+    const size_t align = sizeof(max_align_t) - 1;
+    size_t o = (old + align) & ~align, nn = (n + align) & ~align;
+    if (p && a->cur && (char *)p + o == (char *)a->cur->data + a->cur->used &&
+        a->cur->used - o + nn <= a->cur->cap) {
+        a->cur->used = a->cur->used - o + nn;
+        return p;
+    }
+    void *r = arena_alloc(a, n);
+    if (p) memcpy(r, p, old < n ? old : n);
+    return r;
+}
+
+/* Growable NUL-terminated string in line_arena */
+typedef struct {
+    char *s;
+    size_t len, cap;
+} strbuf_t;
+
+static void sb_reserve(strbuf_t *b, size_t extra) {
+    if (b->len + extra + 1 <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 64;
+    while (cap < b->len + extra + 1) cap *= 2;
+    b->s = arena_grow(&line_arena, b->s, b->cap, cap);
+    b->cap = cap;
+}
+
+static void sb_putn(strbuf_t *b, const char *s, size_t n) {
+    sb_reserve(b, n);
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+}
+
+static void sb_putc(strbuf_t *b, char c) {
+    sb_reserve(b, 1);
+    b->s[b->len++] = c;
+    b->s[b->len] = '\0';
+}
+
+static void sb_puts(strbuf_t *b, const char *s) {
+    sb_putn(b, s, strlen(s));
+}
+
+/* argv[from..to) joined with single spaces */
+static char *sb_join(char **argv, int from, int to) {
+    strbuf_t b = {0};
+    sb_reserve(&b, 0);
+    for (int i = from; i < to; i++) {
+        if (i > from) sb_putc(&b, ' ');
+        sb_puts(&b, argv[i]);
+    }
+    return b.s;
+}
+
+/* Growable string array in line_arena */
+typedef struct {
+    char **v;
+    int n, cap;
+} strvec_t;
+
+static void strvec_push(strvec_t *sv, char *s) {
+    if (sv->n == sv->cap) {
+        int cap = sv->cap ? sv->cap * 2 : 16;
+        sv->v = arena_grow(&line_arena, sv->v, sizeof(char *) * (size_t)sv->cap, sizeof(char *) * (size_t)cap);
+        sv->cap = cap;
+    }
+    sv->v[sv->n++] = s;
+}
+
+/* Release everything allocated since the last reset */
+static void arena_reset(arena_t *a) {
+    a->cur = a->head;
+    if (a->cur) a->cur->used = 0;
+}
+
+/* ---------- Tracing ---------- */
+/* Chrome trace-event output ("X" complete events, JSON array format) of
+   the shell's own phases, opened by MYSH_TRACE=file or `trace on`. Load
+   the file in chrome://tracing or Perfetto. Events are formatted into a
+   private buffer and written with write(2), so forked children never
+   re-flush it; when tracing is off each probe is one branch. */
+
+#define TRACE_BUF 65536
+
+static int trace_fd = -1;
+static char trace_buf[TRACE_BUF];
+static size_t trace_len = 0;
+static bool trace_first = true;
+static char *trace_path = NULL;
+
+static uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_flush(void) {
+    size_t off = 0;
+    while (off < trace_len) {
+        ssize_t w = write(trace_fd, trace_buf + off, trace_len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += (size_t)w;
+    }
+    trace_len = 0;
+}
+
+static void trace_put(const char *s, size_t n) {
+    if (trace_len + n > sizeof(trace_buf)) trace_flush();
+    if (n > sizeof(trace_buf)) return;
+    memcpy(trace_buf + trace_len, s, n);
+    trace_len += n;
+}
+
+/* Start of a span: 0 when tracing is off */
+static uint64_t trace_begin(void) {
+    return trace_fd >= 0 ? trace_now_ns() : 0;
+}
+
+/* A span from t0 to t1; detail (may be NULL) becomes args.detail */
+static void trace_span(const char *name, uint64_t t0, uint64_t t1, const char *detail) {
+    if (trace_fd < 0 || t0 == 0) return;
+    char ev[768];
+    int n = snprintf(ev, sizeof(ev),
+                     "%s{\"name\":\"%s\",\"cat\":\"mysh\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                     trace_first ? "" : ",\n", name, t0 / 1e3, (t1 - t0) / 1e3, (int)getpid(), (int)getpid());
+    if (detail && n > 0 && (size_t)n < sizeof(ev) - 32) {
+        n += snprintf(ev + n, sizeof(ev) - (size_t)n, ",\"args\":{\"detail\":\"");
+        /* JSON-escape, truncating long command lines */
+        for (const char *d = detail; *d && (size_t)n < sizeof(ev) - 16; d++) {
+            unsigned char c = (unsigned char)*d;
+            if (c == '"' || c == '\\') { ev[n++] = '\\'; ev[n++] = (char)c; }
+            else if (c < 0x20) n += snprintf(ev + n, sizeof(ev) - (size_t)n, "\\u%04x", c);
+            else ev[n++] = (char)c;
+        }
+        n += snprintf(ev + n, sizeof(ev) - (size_t)n, "\"}");
+    }
+    if (n > 0 && (size_t)n < sizeof(ev) - 2) {
+        ev[n++] = '}';
+        trace_put(ev, (size_t)n);
+        trace_first = false;
+    }
+}
+
+/* End the span started at t0 */
+static void trace_end_detail(const char *name, uint64_t t0, const char *detail) {
+    if (trace_fd < 0 || t0 == 0) return;
+    trace_span(name, t0, trace_now_ns(), detail);
+}
+
+static void trace_end(const char *name, uint64_t t0) {
+    trace_end_detail(name, t0, NULL);
+}
+
+static void trace_stop(void) {
+    if (trace_fd < 0) return;
+    trace_put("\n]\n", 3);
+    trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+static bool trace_start(const char *path) {
+    trace_stop();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    trace_fd = fd;
+    trace_first = true;
+    trace_len = 0;
+    free(trace_path);
+    trace_path = strdup_safe(path);
+    trace_put("[\n", 2);
+    return true;
+}
+
 /* ---------- History path ---------- */
+/* The home directory is resolved once (getpwuid only without $HOME) and
+   both file names are built from it on first use. */
 
-static char *get_history_path(void) {
-    const char *home = getenv("HOME");
+static char *home_file(const char *name) {
+    static const char *home;
     if (!home) {
-        struct passwd *pw = getpwuid(getuid());
-        if (pw) home = pw->pw_dir;
-        else home = ".";
+        home = getenv("HOME");
+        if (!home) {
+            struct passwd *pw = getpwuid(getuid());
+            home = pw ? strdup_safe(pw->pw_dir) : ".";
+        }
     }
-    size_t n = strlen(home) + 1 + strlen(HISTORY_FILE) + 1;
+    size_t n = strlen(home) + 1 + strlen(name) + 1;
     char *p = malloc(n);
     if (!p) { perror("malloc"); exit(1); }
-    snprintf(p, n, "%s/%s", home, HISTORY_FILE);
+    snprintf(p, n, "%s/%s", home, name);
     return p;
 }
 
+static const char *get_history_path(void) {
+    static char *path;
+    if (!path) path = home_file(HISTORY_FILE);
+    return path;
+}
+
+static const char *get_config_path(void) {
+    static char *path;
+    if (!path) path = home_file(HISTORY_FILE "_config");
+    return path;
+}
+
+static const char *get_snapshot_path(void) {
+    static char *path;
+    if (!path) path = home_file(".mysh_snapshot");
+    return path;
+}
+
 /* ---------- Path helpers ---------- */
 
 /* Expand ~ to HOME */
@@ -197,94 +706,280 @@ static void convert_path_windows(char *dst, const char *src) {
 
 /* ---------- Environment expansion ---------- */
 
-static char *expand_env_vars(const char *s) {
-    char result[4096] = {0};
-    int ri = 0;
+/* Shell variables shadow the environment */
+static const char *lookup_var(const char *name) {
+    shell_var_t *v = strmap_get(&var_map, name);
+    if (v) return v->value;
+    return getenv(name);
+}
 
-    for (int i = 0; s && s[i] && ri < 4090; i++) {
-        if (s[i] == '$') {
-            char var[128];
-            int vi = 0;
-            i++;
-            while (s[i] && (isalnum((unsigned char)s[i]) || s[i]=='_') && vi < 127) {
-                var[vi++] = s[i++];
-            }
-            var[vi] = 0;
-            i--;
+/* Positive integer variable, or def when unset/invalid */
+static long var_long(const char *name, long def) {
+    const char *v = lookup_var(name);
+    if (!v || !*v) return def;
+    char *end;
+    long n = strtol(v, &end, 10);
+    return (*end == '\0' && n > 0) ? n : def;
+}
 
-            const char *val = NULL;
-            for (int j = 0; j < var_count; j++) {
-                if (strcmp(shell_vars[j].name, var) == 0) {
-                    val = shell_vars[j].value;
-                    break;
-                }
-            }
-            if (!val) val = getenv(var);
-            if (val) {
-                for (int k=0; val[k] && ri < 4090; k++)
-                    result[ri++] = val[k];
-            }
-        } else {
-            result[ri++] = s[i];
+/* ---------- Output buffer ---------- */
+/* Everything the shell prints itself goes through out_printf. Text piles
+   up in a list of chunks and leaves in one writev per flush: on a terminal
+   when a builtin, box or table is complete (out_end), otherwise only once
+   OUT_FLUSH_AT bytes are pending or before the shell forks, reads input
+   or exits. With NO_COLOR set, TERM=dumb or stdout not a terminal, SGR
+   escapes are dropped as text is added, so no colour codes are written. */
+
+#define OUT_CHUNK 16384
+#define OUT_FLUSH_AT (256 * 1024)
+
+typedef struct { char *buf; size_t len, cap; } out_chunk_t;
+
+static struct {
+    out_chunk_t *chunks;
+    int nchunks;        /* chunks holding pending text */
+    int nalloc;         /* chunks allocated (kept across flushes) */
+    size_t pending;
+    bool ready, tty, color;
+} out;
+
+/* Re-evaluated at startup, when NO_COLOR changes and when stdout moves */
+static void out_setup(void) {
+    const char *no_color = lookup_var("NO_COLOR");
+    const char *term = getenv("TERM");
+    out.tty = isatty(STDOUT_FILENO);
+    out.color = out.tty && !(no_color && *no_color) && !(term && strcmp(term, "dumb") == 0);
+    out.ready = true;
+}
+
+/* Strip "ESC [ params m" sequences in place; returns the new length */
+static size_t out_strip_sgr(char *s, size_t n) {
+    char *esc = memchr(s, '\033', n);
+    if (!esc) return n;
+    char *w = esc, *end = s + n;
+    for (char *r = esc; r < end; ) {
+        if (r[0] == '\033' && r + 1 < end && r[1] == '[') {
+            char *q = r + 2;
+            while (q < end && (isdigit((unsigned char)*q) || *q == ';')) q++;
+            if (q < end && *q == 'm') { r = q + 1; continue; }
+        }
+        *w++ = *r++;
+    }
+    return (size_t)(w - s);
+}
+
+static void out_flush(void) {
+    fflush(stdout);
+    int i = 0;
+    while (i < out.nchunks) {
+        struct iovec iov[64];
+        int k = 0;
+        for (; k < 64 && i + k < out.nchunks; k++) {
+            iov[k].iov_base = out.chunks[i + k].buf;
+            iov[k].iov_len = out.chunks[i + k].len;
+        }
+        ssize_t w = writev(STDOUT_FILENO, iov, k);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) break;      /* EPIPE and friends: the output is lost */
+        /* consume what was written; a short write resumes mid-chunk */
+        while (i < out.nchunks && (size_t)w >= out.chunks[i].len) w -= (ssize_t)out.chunks[i++].len;
+        if (w > 0) {
+            out_chunk_t *c = &out.chunks[i];
+            memmove(c->buf, c->buf + w, c->len - (size_t)w);
+            c->len -= (size_t)w;
         }
     }
-    result[ri] = 0;
-    return strdup_safe(result);
+    for (int j = 0; j < out.nchunks; j++) out.chunks[j].len = 0;
+    out.nchunks = 0;
+    out.pending = 0;
+}
+
+/* A box or table is complete: terminals see it now, pipes keep buffering */
+static void out_end(void) {
+    if (out.tty) out_flush();
+}
+
+/* The last chunk, or a fresh one, with at least need bytes free */
+static out_chunk_t *out_tail(size_t need) {
+    if (out.nchunks > 0) {
+        out_chunk_t *c = &out.chunks[out.nchunks - 1];
+        if (c->cap - c->len >= need) return c;
+    }
+    if (out.nchunks == out.nalloc) {
+        int ncap = out.nalloc ? out.nalloc * 2 : 8;
+        out_chunk_t *nc = realloc(out.chunks, sizeof(out_chunk_t) * (size_t)ncap);
+        if (!nc) { perror("realloc"); exit(1); }
+        memset(nc + out.nalloc, 0, sizeof(out_chunk_t) * (size_t)(ncap - out.nalloc));
+        out.chunks = nc;
+        out.nalloc = ncap;
+    }
+    out_chunk_t *c = &out.chunks[out.nchunks++];
+    if (c->cap < need) {
+        size_t cap = need > OUT_CHUNK ? need : OUT_CHUNK;
+        char *nb = realloc(c->buf, cap);
+        if (!nb) { perror("realloc"); exit(1); }
+        c->buf = nb;
+        c->cap = cap;
+    }
+    c->len = 0;
+    return c;
+}
+
+static void out_commit(out_chunk_t *c, size_t n) {
+    if (!out.color) n = out_strip_sgr(c->buf + c->len, n);
+    c->len += n;
+    out.pending += n;
+    if (out.pending >= OUT_FLUSH_AT) out_flush();
+}
+
+static void out_write(const char *s, size_t n) {
+    if (!out.ready) out_setup();
+    out_chunk_t *c = out_tail(n);
+    memcpy(c->buf + c->len, s, n);
+    out_commit(c, n);
+}
+
+static __attribute__((format(printf, 1, 2))) void out_printf(const char *fmt, ...) {
+    if (!out.ready) out_setup();
+    out_chunk_t *c = out_tail(1);
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(c->buf + c->len, c->cap - c->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= c->cap - c->len) {
+        c = out_tail((size_t)n + 1);
+        va_start(ap, fmt);
+        vsnprintf(c->buf + c->len, c->cap - c->len, fmt, ap);
+        va_end(ap);
+    }
+    out_commit(c, (size_t)n);
+}
+
+/* ---------- Command hash (like bash's `hash`) ---------- */
+/* Absolute paths of PATH commands, filled on first lookup so the child can
+   execv directly instead of letting execvp probe every PATH directory.
+   Cleared by `hash -r` and whenever set/unset touches PATH. */
+
+typedef struct {
+    char *name;
+    char *path;
+    int hits;
+} cmd_hash_entry_t;
+
+static strmap_t cmd_hash;
+
+static char *search_path(const char *name) {
+    const char *path = lookup_var("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+
+    size_t nlen = strlen(name);
+    const char *dir = path;
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dlen = end ? (size_t)(end - dir) : strlen(dir);
+        char full[4096];
+        if (dlen == 0) snprintf(full, sizeof(full), "./%s", name);
+        else if (dlen + 1 + nlen < sizeof(full)) snprintf(full, sizeof(full), "%.*s/%s", (int)dlen, dir, name);
+        else full[0] = '\0';
+
+        struct stat st;
+        if (full[0] && stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0)
+            return strdup_safe(full);
+        if (!end) break;
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+/* Resolve a bare command name through the hash; NULL if not on PATH.
+   Names containing '/' are never hashed. */
+static cmd_hash_entry_t *hash_lookup(const char *name) {
+    if (!name || !*name || strchr(name, '/')) return NULL;
+    cmd_hash_entry_t *e = strmap_get(&cmd_hash, name);
+    if (e) return e;
+
+    char *full = search_path(name);
+    if (!full) return NULL;
+    e = malloc(sizeof(*e));
+    if (!e) { perror("malloc"); exit(1); }
+    e->name = strdup_safe(name);
+    e->path = full;
+    e->hits = 0;
+    strmap_put(&cmd_hash, e->name, e);
+    return e;
+}
+
+static void hash_clear(void) {
+    for (size_t i = 0; i < cmd_hash.cap; i++) {
+        if (!cmd_hash.slots[i].key) continue;
+        cmd_hash_entry_t *e = cmd_hash.slots[i].value;
+        free(e->name);
+        free(e->path);
+        free(e);
+    }
+    strmap_clear(&cmd_hash);
 }
 
 /* ---------- UI: borders, header, prompt ---------- */
 
 static void print_header_border(const char *title) {
-    printf(CLR_NEON_CYAN "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-    printf(CLR_NEON_CYAN "│" CLR_RESET);
-    printf(BOLD_NEON_CYAN " %-63s " CLR_RESET, title);
-    printf(CLR_NEON_CYAN "│\n" CLR_RESET);
-    printf(CLR_NEON_CYAN "└─────────────────────────────────────────────────────────────────┘\n" CLR_RESET);
+    out_printf(CLR_NEON_CYAN "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_NEON_CYAN "│" CLR_RESET);
+    out_printf(BOLD_NEON_CYAN " %-63s " CLR_RESET, title);
+    out_printf(CLR_NEON_CYAN "│\n" CLR_RESET);
+    out_printf(CLR_NEON_CYAN "└─────────────────────────────────────────────────────────────────┘\n" CLR_RESET);
 }
 
 static void print_section_border(const char *title) {
-    printf(CLR_DARK_GRAY "├── " CLR_NEON_CYAN "%s" CLR_DARK_GRAY " ", title);
-    for (int i = strlen(title) + 4; i < 65; i++) printf("─");
-    printf("┤\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├── " CLR_NEON_CYAN "%s" CLR_DARK_GRAY " ", title);
+    for (int i = strlen(title) + 4; i < 65; i++) out_printf("─");
+    out_printf("┤\n" CLR_RESET);
 }
 
 static void print_content_line(const char *left, const char *right) {
-    printf(CLR_DARK_GRAY "│ " CLR_NEON_CYAN "%-20s" CLR_DARK_GRAY " " CLR_LIGHT_GRAY "%-42s" CLR_DARK_GRAY " │\n", left, right);
+    out_printf(CLR_DARK_GRAY "│ " CLR_NEON_CYAN "%-20s" CLR_DARK_GRAY " " CLR_LIGHT_GRAY "%-42s" CLR_DARK_GRAY " │\n", left, right);
 }
 
 static void print_bottom_border() {
-    printf(CLR_DARK_GRAY "└─────────────────────────────────────────────────────────────────┘\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "└─────────────────────────────────────────────────────────────────┘\n" CLR_RESET);
 }
 
 /* Loading bar, boot sound and achievement popups (cosmetic) */
 
 static void show_loading_bar(const char *message) {
-    printf("\n" CLR_DARK_GRAY "[" CLR_NEON_CYAN "SYSTEM" CLR_DARK_GRAY "] " CLR_NEON_PINK "%s" CLR_RESET "\n", message);
-    printf(CLR_DARK_GRAY "[");
+    if (!interactive) return;
+    out_printf("\n" CLR_DARK_GRAY "[" CLR_NEON_CYAN "SYSTEM" CLR_DARK_GRAY "] " CLR_NEON_PINK "%s" CLR_RESET "\n", message);
+    out_printf(CLR_DARK_GRAY "[");
+    /* animated on a terminal (one write per step), a finished bar elsewhere */
     for (int i = 0; i < 20; i++) {
-        printf(CLR_NEON_CYAN "█");
-        fflush(stdout);
-        sleep_us(25000);
+        out_printf(CLR_NEON_CYAN "█");
+        if (out.tty) {
+            out_flush();
+            sleep_us(25000);
+        }
     }
-    printf(CLR_DARK_GRAY "] " CLR_NEON_GREEN "DONE\n\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "] " CLR_NEON_GREEN "DONE\n\n" CLR_RESET);
 }
 
 static void play_boot_sound() {
-    printf("\a");
+    out_printf("\a");
+    out_end();
     sleep_us(200000);
-    printf("\a");
+    out_printf("\a");
 }
 
 static void unlock_achievement(const char *name, const char *description) {
-    printf("\n");
-    printf(CLR_NEON_PINK "╭─────────────────────────────────────────────────────────────────╮\n" CLR_RESET);
-    printf(CLR_NEON_PINK "│" CLR_NEON_YELLOW "    🏆 ACHIEVEMENT UNLOCKED! 🏆           " CLR_NEON_PINK "                         │\n" CLR_RESET);
-    printf(CLR_NEON_PINK "│" BOLD_NEON_CYAN " %-63s " CLR_NEON_PINK "│\n", name);
-    printf(CLR_NEON_PINK "│" CLR_NEON_GREEN " %-63s " CLR_NEON_PINK "│\n", description);
-    printf(CLR_NEON_PINK "╰─────────────────────────────────────────────────────────────────╯\n" CLR_RESET);
-    printf("\n");
+    out_printf("\n");
+    out_printf(CLR_NEON_PINK "╭─────────────────────────────────────────────────────────────────╮\n" CLR_RESET);
+    out_printf(CLR_NEON_PINK "│" CLR_NEON_YELLOW "    🏆 ACHIEVEMENT UNLOCKED! 🏆           " CLR_NEON_PINK "                         │\n" CLR_RESET);
+    out_printf(CLR_NEON_PINK "│" BOLD_NEON_CYAN " %-63s " CLR_NEON_PINK "│\n", name);
+    out_printf(CLR_NEON_PINK "│" CLR_NEON_GREEN " %-63s " CLR_NEON_PINK "│\n", description);
+    out_printf(CLR_NEON_PINK "╰─────────────────────────────────────────────────────────────────╯\n" CLR_RESET);
+    out_printf("\n");
     for (int i = 0; i < 2; i++) {
-        printf("\a");
+        out_printf("\a");
+        out_end();
         sleep_us(150000);
     }
 }
@@ -317,10 +1012,10 @@ static void check_achievements(const char *command, int cmd_count) {
 }
 
 static void print_cyberpunk_header() {
-    printf("\n");
+    out_printf("\n");
     print_header_border("🚀 CYBER-SHELL v2.0 🚀");
-    printf(CLR_NEON_PURPLE "     Advanced Command Interface • Neural Network Online\n" CLR_RESET);
-    printf("\n");
+    out_printf(CLR_NEON_PURPLE "     Advanced Command Interface • Neural Network Online\n" CLR_RESET);
+    out_printf("\n");
 
     play_boot_sound();
     show_loading_bar("INITIALIZING NEURAL INTERFACE");
@@ -334,35 +1029,92 @@ static void print_cyberpunk_header() {
     char timestr[64];
     strftime(timestr, sizeof(timestr), "%H:%M:%S • %Y-%m-%d", &tm);
 
-    printf(CLR_DARK_GRAY "[" CLR_NEON_CYAN "SYSTEM STATUS" CLR_DARK_GRAY "]\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "│ " CLR_NEON_CYAN "👤 USER: " CLR_LIGHT_GRAY "%-12s" CLR_NEON_CYAN " 🖥️  HOST: " CLR_LIGHT_GRAY "%-15s" CLR_NEON_CYAN " 🕐 TIME: " CLR_LIGHT_GRAY "%s" CLR_DARK_GRAY " │\n",
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_CYAN "SYSTEM STATUS" CLR_DARK_GRAY "]\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│ " CLR_NEON_CYAN "👤 USER: " CLR_LIGHT_GRAY "%-12s" CLR_NEON_CYAN " 🖥️  HOST: " CLR_LIGHT_GRAY "%-15s" CLR_NEON_CYAN " 🕐 TIME: " CLR_LIGHT_GRAY "%s" CLR_DARK_GRAY " │\n",
            user, host, timestr);
-    printf("\n");
+    out_printf("\n");
 
-    printf(CLR_NEON_PURPLE "💡 " CLR_NEON_CYAN "Type 'help' for cyber-commands • 'exit' to terminate session\n" CLR_RESET);
-    printf(CLR_NEON_PURPLE "🔮 " CLR_NEON_CYAN "TAB-completion active • Neural suggestions enabled\n" CLR_RESET);
-    printf("\n");
+    out_printf(CLR_NEON_PURPLE "💡 " CLR_NEON_CYAN "Type 'help' for cyber-commands • 'exit' to terminate session\n" CLR_RESET);
+    out_printf(CLR_NEON_PURPLE "🔮 " CLR_NEON_CYAN "TAB-completion active • Neural suggestions enabled\n" CLR_RESET);
+    out_printf("\n");
 }
 
-/* Build the prompt string */
-static void build_cyberpunk_prompt(char *buf, size_t bufsz, int last_status) {
-    char host[128]; gethostname(host, sizeof(host));
-    struct passwd *pw = getpwuid(getuid());
-    const char *user = pw ? pw->pw_name : "user";
+/* Prompt segment cache. User and host are resolved once, the cwd segment
+   is refreshed by a successful cd, the clock only when the minute changes
+   and the bg count follows running_jobs. With PROMPT_RUSAGE set, the last
+   pipeline's wall time and peak RSS are shown too. The prompt string is
+   rebuilt only when one of those segments is dirty. */
+static struct {
+    bool identity_loaded;
+    bool cwd_loaded;
+    bool dirty;
+    char user[64];
+    char host[128];
+    char cwd[1024];
+    char timestr[16];
+    time_t minute;
+    int last_status;
+    int bgcount;
+    char rusage[64];
+    char buf[PROMPT_BUF];
+} prompt_cache = { .dirty = true, .minute = -1 };
+
+/* Re-read the working directory for the prompt (after a successful cd) */
+static void prompt_refresh_cwd(void) {
+    char cwd[1024];
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "?");
+    convert_path_windows(prompt_cache.cwd, cwd);
+    prompt_cache.cwd_loaded = true;
+    prompt_cache.dirty = true;
+}
+
+/* Build the prompt string (returns the cached buffer) */
+static const char *build_cyberpunk_prompt(int status) {
+    if (!prompt_cache.identity_loaded) {
+        if (gethostname(prompt_cache.host, sizeof(prompt_cache.host)) != 0)
+            strcpy(prompt_cache.host, "localhost");
+        prompt_cache.host[sizeof(prompt_cache.host)-1] = '\0';
+        struct passwd *pw = getpwuid(getuid());
+        snprintf(prompt_cache.user, sizeof(prompt_cache.user), "%s", pw ? pw->pw_name : "user");
+        prompt_cache.identity_loaded = true;
+    }
+    if (!prompt_cache.cwd_loaded) prompt_refresh_cwd();
 
     time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    char timestr[16];
-    strftime(timestr, sizeof(timestr), "%H:%M", &tm);
+    if (t / 60 != prompt_cache.minute) {
+        struct tm tm = *localtime(&t);
+        strftime(prompt_cache.timestr, sizeof(prompt_cache.timestr), "%H:%M", &tm);
+        prompt_cache.minute = t / 60;
+        prompt_cache.dirty = true;
+    }
 
-    char cwd[512]; getcwd(cwd, sizeof(cwd));
-    char display_cwd[512];
-    convert_path_windows(display_cwd, cwd);
+    int bgcount = running_jobs;
+    if (status != prompt_cache.last_status || bgcount != prompt_cache.bgcount) {
+        prompt_cache.last_status = status;
+        prompt_cache.bgcount = bgcount;
+        prompt_cache.dirty = true;
+    }
+    char rusage[64] = "";
+    const char *want_rusage = lookup_var("PROMPT_RUSAGE");
+    if (want_rusage && *want_rusage && strcmp(want_rusage, "0") != 0 && last_usage.valid) {
+        snprintf(rusage, sizeof(rusage), CLR_DARK_GRAY " • " CLR_NEON_PURPLE "⏱ %.2fs %ldK" CLR_RESET,
+                 last_usage.total.wall, last_usage.total.maxrss);
+    }
+    if (strcmp(rusage, prompt_cache.rusage) != 0) {
+        strcpy(prompt_cache.rusage, rusage);
+        prompt_cache.dirty = true;
+    }
+    if (!prompt_cache.dirty) return prompt_cache.buf;
+    prompt_cache.dirty = false;
 
-    int bgcount = 0;
-    for (int i=0;i<jobs_count;i++) if (jobs[i].state==JOB_RUNNING) bgcount++;
+    char *buf = prompt_cache.buf;
+    size_t bufsz = sizeof(prompt_cache.buf);
+    const char *user = prompt_cache.user;
+    const char *host = prompt_cache.host;
+    const char *timestr = prompt_cache.timestr;
+    const char *display_cwd = prompt_cache.cwd;
 
-    const char *status_icon = (last_status == 0) ? CLR_NEON_GREEN "✓" : CLR_NEON_PINK "✗";
+    const char *status_icon = (status == 0) ? CLR_NEON_GREEN "✓" : CLR_NEON_PINK "✗";
     const char *prompt_char = CLR_NEON_CYAN "➜" CLR_RESET;
 
     if (bgcount > 0) {
@@ -371,27 +1123,29 @@ static void build_cyberpunk_prompt(char *buf, size_t bufsz, int last_status) {
             CLR_NEON_PINK "%s" CLR_RESET CLR_DARK_GRAY "@" CLR_RESET
             CLR_NEON_CYAN "%s" CLR_RESET CLR_DARK_GRAY " • " CLR_RESET
             CLR_NEON_YELLOW "%s" CLR_RESET CLR_DARK_GRAY " • " CLR_RESET
-            CLR_NEON_BLUE "%s" CLR_RESET " %s " CLR_NEON_ORANGE "[bg:%d]" CLR_RESET " ",
-            status_icon, user, host, timestr, display_cwd, prompt_char, bgcount);
+            CLR_NEON_BLUE "%s" CLR_RESET "%s %s " CLR_NEON_ORANGE "[bg:%d]" CLR_RESET " ",
+            status_icon, user, host, timestr, display_cwd, rusage, prompt_char, bgcount);
     } else {
         snprintf(buf, bufsz,
             CLR_DARK_GRAY "[" CLR_RESET "%s" CLR_DARK_GRAY "] " CLR_RESET
             CLR_NEON_PINK "%s" CLR_RESET CLR_DARK_GRAY "@" CLR_RESET
             CLR_NEON_CYAN "%s" CLR_RESET CLR_DARK_GRAY " • " CLR_RESET
             CLR_NEON_YELLOW "%s" CLR_RESET CLR_DARK_GRAY " • " CLR_RESET
-            CLR_NEON_BLUE "%s" CLR_RESET " %s ",
-            status_icon, user, host, timestr, display_cwd, prompt_char);
+            CLR_NEON_BLUE "%s" CLR_RESET "%s %s ",
+            status_icon, user, host, timestr, display_cwd, rusage, prompt_char);
     }
+    if (!out.color) buf[out_strip_sgr(buf, strlen(buf))] = '\0';
+    return buf;
 }
 
 /* Error printing */
 static void print_cyberpunk_error(const char *text) {
-    printf(CLR_DARK_GRAY "[" CLR_NEON_PINK "ERROR" CLR_DARK_GRAY "] " CLR_NEON_PINK "%s\n" CLR_RESET, text);
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_PINK "ERROR" CLR_DARK_GRAY "] " CLR_NEON_PINK "%s\n" CLR_RESET, text);
 }
 
 /* Optional pretty output (unused) */
 static __attribute__((unused)) void print_cyberpunk_output(const char *text) {
-    printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "OUTPUT" CLR_DARK_GRAY "] " CLR_RESET "%s\n", text);
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "OUTPUT" CLR_DARK_GRAY "] " CLR_RESET "%s\n", text);
 }
 
 /* ---------- Syntax coloring for prompt echo ---------- */
@@ -407,28 +1161,28 @@ static void print_with_syntax_highlighting(const char *text) {
     while (token) {
         if (first_token) {
             if (is_builtin(token)) {
-                printf(CLR_NEON_GREEN "%s" CLR_RESET, token);
-            } else if (access(token, X_OK) == 0) {
-                printf(CLR_NEON_CYAN "%s" CLR_RESET, token);
+                out_printf(CLR_NEON_GREEN "%s" CLR_RESET, token);
+            } else if (strchr(token, '/') ? access(token, X_OK) == 0 : hash_lookup(token) != NULL) {
+                out_printf(CLR_NEON_CYAN "%s" CLR_RESET, token);
             } else {
-                printf(CLR_LIGHT_GRAY "%s" CLR_RESET, token);
+                out_printf(CLR_LIGHT_GRAY "%s" CLR_RESET, token);
             }
             first_token = 0;
         } else if (token[0] == '-') {
-            printf(CLR_NEON_YELLOW "%s" CLR_RESET, token);
+            out_printf(CLR_NEON_YELLOW "%s" CLR_RESET, token);
         } else if (token[0] == '"' || token[0] == '\'') {
-            printf(CLR_NEON_BLUE "%s" CLR_RESET, token);
+            out_printf(CLR_NEON_BLUE "%s" CLR_RESET, token);
         } else if (token[0] == '$') {
-            printf(CLR_NEON_PURPLE "%s" CLR_RESET, token);
+            out_printf(CLR_NEON_PURPLE "%s" CLR_RESET, token);
         } else if (strcmp(token, ">") == 0 || strcmp(token, ">>") == 0 ||
                    strcmp(token, "<") == 0 || strcmp(token, "|") == 0) {
-            printf(CLR_NEON_PINK "%s" CLR_RESET, token);
+            out_printf(CLR_NEON_PINK "%s" CLR_RESET, token);
         } else {
-            printf(CLR_LIGHT_GRAY "%s" CLR_RESET, token);
+            out_printf(CLR_LIGHT_GRAY "%s" CLR_RESET, token);
         }
 
         token = strtok_r(NULL, " ", &saveptr);
-        if (token) printf(" ");
+        if (token) out_printf(" ");
     }
 
     free(copy);
@@ -436,133 +1190,439 @@ static void print_with_syntax_highlighting(const char *text) {
 
 /* ---------- Alias management ---------- */
 
+/* Drop the lexed words and memoized expansion (the strings are interned) */
+static void alias_forget(alias_t *a) {
+    free(a->words);
+    free(a->exp);
+    a->words = a->exp = NULL;
+    a->nwords = a->nexp = 0;
+    a->words_ready = false;
+}
+
+/* name is interned, value is adopted (see release_value) */
+static void alias_store(const char *name, char *value) {
+    alias_epoch++;
+    alias_t *a = strmap_get(&alias_map, name);
+    if (a) {
+        release_value(a->value);
+        a->value = value;
+        alias_forget(a);
+        return;
+    }
+
+    a = calloc(1, sizeof(*a));
+    if (!a) { perror("calloc"); exit(1); }
+    a->name = name;
+    a->value = value;
+    strmap_put(&alias_map, a->name, a);
+    ptr_array_push((void ***)&aliases, &alias_count, &alias_cap, a);
+    alias_gen++;
+}
+
 static void add_alias(const char *name, const char *value) {
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
-            free(aliases[i].value);
-            aliases[i].value = strdup_safe(value);
-            return;
+    alias_store(intern(name), strdup_safe(value));
+}
+
+static bool remove_alias(const char *name) {
+    alias_t *a = strmap_get(&alias_map, name);
+    if (!a) return false;
+    strmap_del(&alias_map, a->name);
+    ptr_array_remove((void **)aliases, &alias_count, a);
+    release_value(a->value);
+    alias_forget(a);
+    free(a);
+    alias_gen++;
+    alias_epoch++;
+    return true;
+}
+
+/* The words of one alias value. A value without $, ~ or glob characters
+   lexes the same everywhere, so it is tokenized once and its words are
+   interned; other values are tokenized into line_arena on every use. */
+static int alias_words(alias_t *a, char ***out) {
+    if (!a->words_ready) {
+        a->words_ready = true;
+        if (!strpbrk(a->value, "$~*?[")) {
+            int n;
+            char **t = tokenize(a->value, &n);
+            a->words = malloc(sizeof(char *) * (size_t)(n + 1));
+            if (!a->words) { perror("malloc"); exit(1); }
+            for (int i = 0; i < n; i++) a->words[i] = (char *)intern(t[i]);
+            a->words[n] = NULL;
+            a->nwords = n;
         }
     }
+    if (a->words) { *out = a->words; return a->nwords; }
+    int n;
+    *out = tokenize(a->value, &n);
+    return n;
+}
 
-    if (alias_count < MAX_ALIASES) {
-        aliases[alias_count].name = strdup_safe(name);
-        aliases[alias_count].value = strdup_safe(value);
-        alias_count++;
+/* Expand the alias chain at the head of argv: each step splices an alias's
+   words in front of the remaining ones, and an alias already used in the
+   chain is not expanded again, so `alias ls ls -F` and cycles terminate.
+   A chain of lex-once aliases is memoized on its first alias until any
+   alias changes. Returns a NULL-terminated argv in line_arena, or NULL
+   when argv[0] is not an alias. */
+static char **alias_splice(char **argv, int argc, int *argc_out) {
+    alias_t *a = argc > 0 ? strmap_get(&alias_map, argv[0]) : NULL;
+    if (!a) return NULL;
+
+    char **head = a->exp;
+    int nhead = a->nexp;
+    if (!head || a->exp_epoch != alias_epoch) {
+        alias_t **seen = arena_alloc(&line_arena, sizeof(alias_t *) * (size_t)alias_count);
+        int nseen = 0;
+        bool memo = true;
+        nhead = 1;
+        head = argv;        /* only head[0] is looked at before the first splice */
+        for (alias_t *x = a; x; ) {
+            seen[nseen++] = x;
+            char **w;
+            int nw = alias_words(x, &w);
+            memo = memo && x->words;
+            char **next = arena_alloc(&line_arena, sizeof(char *) * (size_t)(nw + nhead));
+            memcpy(next, w, sizeof(char *) * (size_t)nw);
+            memcpy(next + nw, head + 1, sizeof(char *) * (size_t)(nhead - 1));
+            head = next;
+            nhead = nw + nhead - 1;
+
+            x = nhead > 0 ? strmap_get(&alias_map, head[0]) : NULL;
+            for (int k = 0; x && k < nseen; k++) if (seen[k] == x) x = NULL;
+        }
+        if (memo) {
+            free(a->exp);
+            a->exp = malloc(sizeof(char *) * (size_t)(nhead + 1));
+            if (!a->exp) { perror("malloc"); exit(1); }
+            memcpy(a->exp, head, sizeof(char *) * (size_t)nhead);
+            a->nexp = nhead;
+            a->exp_epoch = alias_epoch;
+        }
     }
+
+    char **out = arena_alloc(&line_arena, sizeof(char *) * (size_t)(nhead + argc));
+    memcpy(out, head, sizeof(char *) * (size_t)nhead);
+    memcpy(out + nhead, argv + 1, sizeof(char *) * (size_t)(argc - 1));
+    out[nhead + argc - 1] = NULL;
+    *argc_out = nhead + argc - 1;
+    return out;
 }
 
-static char *expand_aliases(const char *input) {
-    if (!input || !*input) return strdup_safe(input);
+/* ---------- Shell variables ---------- */
 
-    /* Get first word */
-    char *copy = strdup_safe(input);
-    char *first_word = strtok(copy, " \t");
-    if (!first_word) {
-        free(copy);
-        return strdup_safe(input);
+/* name is interned, value is adopted (see release_value) */
+static shell_var_t *var_store(const char *name, char *value) {
+    shell_var_t *v = strmap_get(&var_map, name);
+    if (v) {
+        release_value(v->value);
+        v->value = value;
+        return v;
     }
 
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(first_word, aliases[i].name) == 0) {
-            const char *rest = input + strlen(first_word);
-            while (*rest == ' ' || *rest == '\t') rest++;
+    v = malloc(sizeof(*v));
+    if (!v) { perror("malloc"); exit(1); }
+    v->name = name;
+    v->value = value;
+    strmap_put(&var_map, v->name, v);
+    ptr_array_push((void ***)&shell_vars, &var_count, &var_cap, v);
+    return v;
+}
 
-            char expanded[4096];
-            snprintf(expanded, sizeof(expanded), "%s", aliases[i].value);
+static shell_var_t *store_shell_var(const char *name, const char *value) {
+    return var_store(intern(name), strdup_safe(value));
+}
 
-            if (*rest != '\0') {
-                strncat(expanded, " ", sizeof(expanded) - strlen(expanded) - 1);
-                strncat(expanded, rest, sizeof(expanded) - strlen(expanded) - 1);
-            }
+static void set_shell_var(const char *name, const char *value) {
+    store_shell_var(name, value)->transient = false;
+}
+
+/* Shell-maintained values (MYSH_LAST_RUSAGE, ...): readable as $NAME
+   but not written to the config file */
+static void set_transient_var(const char *name, const char *value) {
+    store_shell_var(name, value)->transient = true;
+}
+
+static bool unset_shell_var(const char *name) {
+    shell_var_t *v = strmap_get(&var_map, name);
+    if (!v) return false;
+    strmap_del(&var_map, v->name);
+    ptr_array_remove((void **)shell_vars, &var_count, v);
+    release_value(v->value);
+    free(v);
+    return true;
+}
+
+/* ---------- Binary snapshot ---------- */
+/* With MYSH_SNAPSHOT set, leaving the shell also writes ~/.mysh_snapshot:
+   a versioned header, then length-prefixed sections - a string table and
+   fixed-size alias, variable and history records indexing into it. It is
+   written to a temp file and renamed into place, and startup maps it
+   once. Aliases and variables come from it while the text config is the
+   one it was written next to (same size and mtime); history entries point
+   straight into the mapping while the history file is unchanged and
+   HISTSIZE matches. Anything else falls back to the text files, which are
+   still written and stay the import/export format. */
+
+#define SNAP_MAGIC "MYSHSNAP"
+#define SNAP_VERSION 1
+
+enum { SNAP_STRINGS = 1, SNAP_ALIASES, SNAP_VARS, SNAP_HISTORY };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nsections;
+    uint64_t config_size;       /* text config the snapshot mirrors */
+    int64_t config_mtime;       /* ns */
+    uint64_t hist_dev, hist_ino, hist_size;
+    int64_t hist_mtime;         /* ns */
+    int64_t hist_file_lines;
+    uint32_t hist_cap;
+    uint32_t hist_unterminated;
+} snap_header_t;
+
+/* Each section: this header, then bytes of payload padded to 8 */
+typedef struct {
+    uint32_t kind, count;
+    uint64_t bytes;
+} snap_section_t;
+
+/* Offset into the string table and length; a NUL follows each string */
+typedef struct { uint32_t off, len; } snap_str_t;
+
+static struct {
+    const char *map;
+    size_t len;
+    const snap_header_t *hdr;
+    const char *strings;
+    size_t strings_len;
+    const snap_str_t *aliases, *vars;   /* name/value pairs */
+    const snap_str_t *history;
+    uint32_t naliases, nvars, nhistory;
+    bool has_history;
+    bool config_used, history_used;     /* for --startup-profile */
+} snap;
+
+static int64_t stat_mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
 
-            free(copy);
-            return strdup_safe(expanded);
+static bool snap_borrowed(const char *p) {
+    return snap.map && p >= snap.map && p < snap.map + snap.len;
+}
+
+static bool snap_str_ok(const snap_str_t *s) {
+    return (size_t)s->off + s->len < snap.strings_len && snap.strings[s->off + s->len] == '\0';
+}
+
+static bool snap_strs_ok(const snap_str_t *v, size_t n) {
+    for (size_t i = 0; i < n; i++) if (!snap_str_ok(&v[i])) return false;
+    return true;
+}
+
+/* Walk and bounds-check every section of the mapping */
+static bool snapshot_parse(const char *m, size_t len) {
+    const snap_header_t *h = (const snap_header_t *)m;
+    if (len < sizeof(*h) || memcmp(h->magic, SNAP_MAGIC, 8) != 0 || h->version != SNAP_VERSION) return false;
+    snap.hdr = h;
+    size_t off = sizeof(*h);
+    for (uint32_t i = 0; i < h->nsections; i++) {
+        if (len - off < sizeof(snap_section_t)) return false;
+        const snap_section_t *sec = (const snap_section_t *)(m + off);
+        off += sizeof(*sec);
+        if (sec->bytes > len - off) return false;
+        const char *p = m + off;
+        size_t recs = sec->kind == SNAP_HISTORY ? sec->count : 2 * (size_t)sec->count;
+        if (sec->kind != SNAP_STRINGS && recs * sizeof(snap_str_t) != sec->bytes) return false;
+        switch (sec->kind) {
+        case SNAP_STRINGS: snap.strings = p; snap.strings_len = sec->bytes; break;
+        case SNAP_ALIASES: snap.aliases = (const snap_str_t *)p; snap.naliases = sec->count; break;
+        case SNAP_VARS: snap.vars = (const snap_str_t *)p; snap.nvars = sec->count; break;
+        case SNAP_HISTORY:
+            snap.history = (const snap_str_t *)p;
+            snap.nhistory = sec->count;
+            snap.has_history = true;
+            break;
+        default: break;     /* unknown sections are skipped */
         }
+        off += (sec->bytes + 7) & ~(uint64_t)7;
+        if (off > len) return false;
+    }
+    return snap.strings &&
+           snap_strs_ok(snap.aliases, 2 * (size_t)snap.naliases) &&
+           snap_strs_ok(snap.vars, 2 * (size_t)snap.nvars) &&
+           snap_strs_ok(snap.history, snap.nhistory);
+}
+
+/* Map the snapshot (kept for the history entries that point into it) and
+   apply its aliases and variables if the text config has not moved on */
+static bool snapshot_load(void) {
+    int fd = open(get_snapshot_path(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return false;
+    if (!snapshot_parse(m, (size_t)st.st_size)) {
+        munmap(m, (size_t)st.st_size);
+        memset(&snap, 0, sizeof(snap));
+        return false;
     }
+    snap.map = m;
+    snap.len = (size_t)st.st_size;
+
+    struct stat cs;
+    if (stat(get_config_path(), &cs) != 0 || (uint64_t)cs.st_size != snap.hdr->config_size ||
+        stat_mtime_ns(&cs) != snap.hdr->config_mtime)
+        return false;
+    /* names and values stay in the mapping: no copies */
+    for (uint32_t i = 0; i < snap.naliases; i++)
+        alias_store(intern_keep(snap.strings + snap.aliases[2*i].off),
+                    (char *)snap.strings + snap.aliases[2*i+1].off);
+    for (uint32_t i = 0; i < snap.nvars; i++)
+        var_store(intern_keep(snap.strings + snap.vars[2*i].off),
+                  (char *)snap.strings + snap.vars[2*i+1].off)->transient = false;
+    return true;
+}
 
-    free(copy);
-    return strdup_safe(input);
+static snap_str_t snap_put_string(strbuf_t *strings, const char *s, size_t n) {
+    snap_str_t r = { (uint32_t)strings->len, (uint32_t)n };
+    sb_putn(strings, s, n);
+    sb_putc(strings, '\0');
+    return r;
 }
 
-/* ---------- Shell variables ---------- */
+static void snap_put_section(strbuf_t *out, uint32_t kind, uint32_t count, const strbuf_t *payload) {
+    snap_section_t sec = { kind, count, payload->len };
+    sb_putn(out, (const char *)&sec, sizeof(sec));
+    sb_putn(out, payload->s ? payload->s : "", payload->len);
+    static const char pad[8];
+    sb_putn(out, pad, (8 - payload->len % 8) % 8);
+}
 
-static void set_shell_var(const char *name, const char *value) {
+/* Write the snapshot, or remove a stale one when MYSH_SNAPSHOT is off.
+   Called after the text config and history file are final. */
+static void snapshot_save(void) {
+    const char *path = get_snapshot_path();
+    const char *want = lookup_var("MYSH_SNAPSHOT");
+    if (!want || !*want || strcmp(want, "0") == 0) {
+        if (snap.map || access(path, F_OK) == 0) unlink(path);
+        return;
+    }
+    history_ensure();
+
+    strbuf_t strings = {0}, aliases_rec = {0}, vars_rec = {0}, hist_rec = {0};
+    for (int i = 0; i < alias_count; i++) {
+        snap_str_t kv[2] = {
+            snap_put_string(&strings, aliases[i]->name, strlen(aliases[i]->name)),
+            snap_put_string(&strings, aliases[i]->value, strlen(aliases[i]->value)),
+        };
+        sb_putn(&aliases_rec, (const char *)kv, sizeof(kv));
+    }
+    uint32_t nvars = 0;
     for (int i = 0; i < var_count; i++) {
-        if (strcmp(shell_vars[i].name, name) == 0) {
-            free(shell_vars[i].value);
-            shell_vars[i].value = strdup_safe(value);
-            return;
-        }
+        if (shell_vars[i]->transient) continue;
+        snap_str_t kv[2] = {
+            snap_put_string(&strings, shell_vars[i]->name, strlen(shell_vars[i]->name)),
+            snap_put_string(&strings, shell_vars[i]->value, strlen(shell_vars[i]->value)),
+        };
+        sb_putn(&vars_rec, (const char *)kv, sizeof(kv));
+        nvars++;
+    }
+    /* the ring lacks lines other shells appended; leave history to the file */
+    struct stat st;
+    bool with_history = history_file_synced && stat(get_history_path(), &st) == 0 &&
+                        st.st_dev == history_file_st.st_dev && st.st_ino == history_file_st.st_ino &&
+                        st.st_size == history_file_st.st_size;
+    for (int i = 0; with_history && i < history_count; i++) {
+        const hist_entry_t *e = history_at(i);
+        snap_str_t s = snap_put_string(&strings, e->text, e->len);
+        sb_putn(&hist_rec, (const char *)&s, sizeof(s));
+    }
+    if (strings.len > UINT32_MAX) return;
+
+    snap_header_t h = { .version = SNAP_VERSION, .nsections = with_history ? 4 : 3,
+                        .hist_cap = (uint32_t)history_cap,
+                        .hist_file_lines = history_file_lines,
+                        .hist_unterminated = history_file_unterminated };
+    memcpy(h.magic, SNAP_MAGIC, 8);
+    if (with_history) {
+        h.hist_dev = (uint64_t)st.st_dev;
+        h.hist_ino = (uint64_t)st.st_ino;
+        h.hist_size = (uint64_t)st.st_size;
+        h.hist_mtime = stat_mtime_ns(&st);
+    }
+    if (stat(get_config_path(), &st) == 0) {
+        h.config_size = (uint64_t)st.st_size;
+        h.config_mtime = stat_mtime_ns(&st);
     }
 
-    if (var_count < MAX_VARS) {
-        shell_vars[var_count].name = strdup_safe(name);
-        shell_vars[var_count].value = strdup_safe(value);
-        var_count++;
+    strbuf_t out = {0};
+    sb_putn(&out, (const char *)&h, sizeof(h));
+    snap_put_section(&out, SNAP_STRINGS, 0, &strings);
+    snap_put_section(&out, SNAP_ALIASES, (uint32_t)alias_count, &aliases_rec);
+    snap_put_section(&out, SNAP_VARS, nvars, &vars_rec);
+    if (with_history) snap_put_section(&out, SNAP_HISTORY, (uint32_t)history_count, &hist_rec);
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    size_t off = 0;
+    while (off < out.len) {
+        ssize_t w = write(fd, out.s + off, out.len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
     }
+    if (close(fd) != 0 || off < out.len || rename(tmp, path) != 0) unlink(tmp);
 }
 
 /* ---------- Persistent config: save/load aliases & vars ---------- */
 
 static void save_persistent_data() {
-    char *path = get_history_path();
-    /* replace .mysh_history with .mysh_history_config (best-effort) */
-    char *dot = strrchr(path, '.');
-    if (dot) {
-        /* ensure we don't overflow */
-        char newpath[4096];
-        snprintf(newpath, sizeof(newpath), "%s_config", path);
-        free(path);
-        path = strdup_safe(newpath);
-    } else {
-        char newpath[4096];
-        snprintf(newpath, sizeof(newpath), "%s_config", path);
-        free(path);
-        path = strdup_safe(newpath);
-    }
-
-    FILE *f = fopen(path, "w");
-    if (!f) { free(path); return; }
+    FILE *f = fopen(get_config_path(), "w");
+    if (!f) { snapshot_save(); return; }
 
     for (int i = 0; i < alias_count; i++) {
-        fprintf(f, "alias %s=%s\n", aliases[i].name, aliases[i].value);
+        fprintf(f, "alias %s=%s\n", aliases[i]->name, aliases[i]->value);
     }
 
     for (int i = 0; i < var_count; i++) {
-        fprintf(f, "set %s=%s\n", shell_vars[i].name, shell_vars[i].value);
+        if (shell_vars[i]->transient) continue;
+        fprintf(f, "set %s=%s\n", shell_vars[i]->name, shell_vars[i]->value);
     }
 
     fclose(f);
-    free(path);
+    snapshot_save();
 }
 
-static void load_persistent_data() {
-    char *path = get_history_path();
-    char *dot = strrchr(path, '.');
-    if (dot) {
-        char newpath[4096];
-        snprintf(newpath, sizeof(newpath), "%s_config", path);
-        free(path);
-        path = strdup_safe(newpath);
-    } else {
-        char newpath[4096];
-        snprintf(newpath, sizeof(newpath), "%s_config", path);
-        free(path);
-        path = strdup_safe(newpath);
+/* One read of the whole file, then the lines are split in place and fed
+   straight into the alias and variable stores. */
+static void load_config_text(void) {
+    int fd = open(get_config_path(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return; }
+    char *buf = malloc((size_t)st.st_size + 1);
+    if (!buf) { perror("malloc"); exit(1); }
+    size_t len = 0;
+    while (len < (size_t)st.st_size) {
+        ssize_t r = read(fd, buf + len, (size_t)st.st_size - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        len += (size_t)r;
     }
+    close(fd);
+    buf[len] = '\0';
 
-    FILE *f = fopen(path, "r");
-    if (!f) { free(path); return; }
-
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-
-    while ((read = getline(&line, &len, f)) != -1) {
-        if (read > 0 && (line[read-1] == '\n' || line[read-1] == '\r')) {
-            line[--read] = 0;
-        }
+    for (char *line = buf, *next; line < buf + len; line = next) {
+        char *end = memchr(line, '\n', (size_t)(buf + len - line));
+        next = end ? end + 1 : buf + len;
+        if (!end) end = buf + len;
+        if (end > line && end[-1] == '\r') end--;
+        *end = '\0';
 
         if (strncmp(line, "alias ", 6) == 0) {
             char *eq = strchr(line + 6, '=');
@@ -579,135 +1639,704 @@ static void load_persistent_data() {
         }
     }
 
-    free(line);
-    fclose(f);
-    free(path);
+    free(buf);
+}
+
+static void load_persistent_data() {
+    snap.config_used = snapshot_load();
+    if (!snap.config_used) load_config_text();
 }
 
 /* ---------- Jobs management ---------- */
 
-static void add_job(pid_t pgid, char *cmdline, job_state_t state) {
-    if (jobs_count >= MAX_JOBS) return;
-    job_t *j = &jobs[jobs_count++];
+/* pid -> job for every live member of a job, so a reaped pid is
+   attributed with one lookup (getpgid no longer works once it's reaped).
+   Open addressing, linear probing, backward-shift deletion. */
+typedef struct {
+    pid_t pid;          /* 0 = empty */
+    job_t *job;
+} pid_job_slot_t;
+
+static pid_job_slot_t *pid_jobs = NULL;
+static size_t pid_jobs_cap = 0;
+static size_t pid_jobs_count = 0;
+
+static size_t pid_job_index(pid_t pid, size_t cap) {
+    return ((uint32_t)pid * 2654435761u) & (cap - 1);
+}
+
+static void pid_job_put(pid_t pid, job_t *job) {
+    if ((pid_jobs_count + 1) * 4 >= pid_jobs_cap * 3) {
+        size_t ncap = pid_jobs_cap ? pid_jobs_cap * 2 : 64;
+        pid_job_slot_t *n = calloc(ncap, sizeof(pid_job_slot_t));
+        if (!n) { perror("calloc"); exit(1); }
+        for (size_t i = 0; i < pid_jobs_cap; i++) {
+            if (!pid_jobs[i].pid) continue;
+            size_t j = pid_job_index(pid_jobs[i].pid, ncap);
+            while (n[j].pid) j = (j + 1) & (ncap - 1);
+            n[j] = pid_jobs[i];
+        }
+        free(pid_jobs);
+        pid_jobs = n;
+        pid_jobs_cap = ncap;
+    }
+    size_t i = pid_job_index(pid, pid_jobs_cap);
+    while (pid_jobs[i].pid && pid_jobs[i].pid != pid) i = (i + 1) & (pid_jobs_cap - 1);
+    if (!pid_jobs[i].pid) pid_jobs_count++;
+    pid_jobs[i] = (pid_job_slot_t){ pid, job };
+}
+
+static pid_job_slot_t *pid_job_slot(pid_t pid) {
+    if (pid_jobs_cap == 0) return NULL;
+    size_t i = pid_job_index(pid, pid_jobs_cap);
+    while (pid_jobs[i].pid != pid) {
+        if (!pid_jobs[i].pid) return NULL;
+        i = (i + 1) & (pid_jobs_cap - 1);
+    }
+    return &pid_jobs[i];
+}
+
+static job_t *pid_job_get(pid_t pid) {
+    pid_job_slot_t *slot = pid_job_slot(pid);
+    return slot ? slot->job : NULL;
+}
+
+/* Remove pid and return its job, or NULL if it wasn't a job member */
+static job_t *pid_job_take(pid_t pid) {
+    pid_job_slot_t *slot = pid_job_slot(pid);
+    if (!slot) return NULL;
+    job_t *job = slot->job;
+    size_t mask = pid_jobs_cap - 1;
+    size_t i = (size_t)(slot - pid_jobs);
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; pid_jobs[j].pid; j = (j + 1) & mask) {
+        size_t home = pid_job_index(pid_jobs[j].pid, pid_jobs_cap);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            pid_jobs[hole] = pid_jobs[j];
+            hole = j;
+        }
+    }
+    pid_jobs[hole].pid = 0;
+    pid_jobs_count--;
+    return job;
+}
+
+/* Registers the live members pids[0..npids) with the new job. st holds
+   the statuses of stages already finished, or is NULL. */
+static job_t *add_job(pid_t pgid, char *cmdline, job_state_t state, const pid_t *pids,
+                      const int *st, int npids) {
+    job_t *j = calloc(1, sizeof(job_t) + (sizeof(pid_t) + sizeof(int)) * (size_t)npids);
+    if (!j) { perror("calloc"); exit(1); }
+    j->nstages = npids;
+    j->stage_pids = (pid_t *)(j + 1);
+    j->stage_status = (int *)(j->stage_pids + npids);
+    if (st) memcpy(j->stage_status, st, sizeof(int) * (size_t)npids);
     j->id = next_job_id++;
     j->pgid = pgid;
     j->cmdline = strdup_safe(cmdline);
     j->state = state;
+    clock_gettime(CLOCK_MONOTONIC, &j->started);
+    for (int i = 0; i < npids; i++) {
+        if (pids[i] <= 0) continue;
+        pid_job_put(pids[i], j);
+        j->stage_pids[i] = pids[i];
+        j->nprocs++;
+        j->last_pid = pids[i];
+    }
+    ptr_array_push((void ***)&jobs, &jobs_count, &jobs_cap, j);
+    if (state == JOB_RUNNING) running_jobs++;
+    return j;
+}
+
+/* All job state changes go through here to keep running_jobs exact */
+static void set_job_state(job_t *j, job_state_t state) {
+    if (j->state == state) return;
+    if (j->state == JOB_RUNNING) running_jobs--;
+    if (state == JOB_RUNNING) running_jobs++;
+    j->state = state;
+}
+
+/* A member was reaped; returns true when that was the last one */
+static bool job_member_exited(job_t *j, pid_t pid, int status) {
+    int code = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    if (pid == j->last_pid) j->status = code;
+    for (int i = 0; i < j->nstages; i++) {
+        if (j->stage_pids[i] != pid) continue;
+        j->stage_pids[i] = 0;
+        j->stage_status[i] = code;
+        break;
+    }
+    if (--j->nprocs > 0) return false;
+    clock_gettime(CLOCK_MONOTONIC, &j->finished);
+    set_job_state(j, JOB_DONE);
+    return true;
 }
 
 static job_t* find_job_by_pgid(pid_t pgid) {
-    for (int i=0;i<jobs_count;i++) if (jobs[i].pgid == pgid) return &jobs[i];
+    for (int i=0;i<jobs_count;i++) if (jobs[i]->pgid == pgid) return jobs[i];
     return NULL;
 }
 
 static job_t* find_job_by_id(int id) {
-    for (int i=0;i<jobs_count;i++) if (jobs[i].id == id) return &jobs[i];
+    for (int i=0;i<jobs_count;i++) if (jobs[i]->id == id) return jobs[i];
     return NULL;
 }
 
 static void remove_done_jobs() {
     int w = 0;
     for (int i=0;i<jobs_count;i++) {
-        if (jobs[i].state == JOB_DONE) {
-            free(jobs[i].cmdline);
+        if (jobs[i]->state == JOB_DONE) {
+            /* nprocs is 0, so no pid_jobs entry points here any more */
+            if (jobs[i] == last_bg_job) last_bg_job = NULL;
+            free(jobs[i]->cmdline);
+            free(jobs[i]);
             continue;
         }
-        if (w != i) jobs[w] = jobs[i];
-        w++;
+        /* only JOB_DONE entries are dropped, so running_jobs is unchanged */
+        jobs[w++] = jobs[i];
     }
     jobs_count = w;
 }
 
 static void print_jobs() {
-    printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                    BACKGROUND PROCESSES                    " CLR_DARK_GRAY "│\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                    BACKGROUND PROCESSES                    " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
 
     for (int i=0;i<jobs_count;i++) {
-        const char *s = jobs[i].state==JOB_RUNNING? CLR_NEON_GREEN "Running" :
-                       jobs[i].state==JOB_STOPPED? CLR_NEON_YELLOW "Stopped" :
-                       CLR_NEON_PINK "Done";
-        printf(CLR_DARK_GRAY "│ " CLR_NEON_CYAN "[%d]" CLR_DARK_GRAY " %-10s " CLR_LIGHT_GRAY "%-47s" CLR_DARK_GRAY " │\n",
-               jobs[i].id, s, jobs[i].cmdline);
+        const char *s = jobs[i]->state==JOB_RUNNING? "Running" :
+                       jobs[i]->state==JOB_STOPPED? "Stopped" : "Done";
+        const char *clr = jobs[i]->state==JOB_RUNNING? CLR_NEON_GREEN :
+                         jobs[i]->state==JOB_STOPPED? CLR_NEON_YELLOW : CLR_NEON_PINK;
+        out_printf(CLR_DARK_GRAY "│ " CLR_NEON_CYAN "[%d]" CLR_DARK_GRAY " %s%-10s " CLR_LIGHT_GRAY "%-47s" CLR_DARK_GRAY " │\n",
+               jobs[i]->id, clr, s, jobs[i]->cmdline);
+    }
+
+    out_printf(CLR_DARK_GRAY "└─────────────────────────────────────────────────────────────────┘\n" CLR_RESET);
+}
+
+/* ---------- History search index ---------- */
+/* Trigram index over case-folded history text. Each trigram maps to an
+   ascending posting list of entry sequence numbers (seq = position in
+   the whole history, not the ring slot), so the oldest entry is always
+   at the front of any list it appears in and eviction is a pop. Queries
+   of three bytes or more only visit the entries on the shortest posting
+   list of their trigrams. */
+
+typedef struct {
+    uint32_t key;       /* folded trigram + 1; 0 = empty slot */
+    uint32_t start;     /* first live element */
+    uint32_t len;
+    uint32_t cap;
+    uint32_t *seqs;
+} tri_post_t;
+
+static tri_post_t *tri_slots = NULL;
+static uint32_t tri_cap = 0;
+static uint32_t tri_count = 0;
+
+static uint32_t tri_key(const char *p) {
+    return (((uint32_t)(unsigned char)tolower((unsigned char)p[0]) << 16) |
+            ((uint32_t)(unsigned char)tolower((unsigned char)p[1]) << 8) |
+             (uint32_t)(unsigned char)tolower((unsigned char)p[2])) + 1;
+}
+
+static tri_post_t *tri_slot(uint32_t key, bool create) {
+    if (tri_cap == 0) {
+        if (!create) return NULL;
+        tri_cap = 1024;
+        tri_slots = calloc(tri_cap, sizeof(tri_post_t));
+        if (!tri_slots) { perror("calloc"); exit(1); }
+    }
+    if (create && (tri_count + 1) * 4 >= tri_cap * 3) {
+        uint32_t ncap = tri_cap * 2;
+        tri_post_t *n = calloc(ncap, sizeof(tri_post_t));
+        if (!n) { perror("calloc"); exit(1); }
+        for (uint32_t i = 0; i < tri_cap; i++) {
+            if (!tri_slots[i].key) continue;
+            uint32_t j = (tri_slots[i].key * 2654435761u) & (ncap - 1);
+            while (n[j].key) j = (j + 1) & (ncap - 1);
+            n[j] = tri_slots[i];
+        }
+        free(tri_slots);
+        tri_slots = n;
+        tri_cap = ncap;
+    }
+    uint32_t i = (key * 2654435761u) & (tri_cap - 1);
+    while (tri_slots[i].key) {
+        if (tri_slots[i].key == key) return &tri_slots[i];
+        i = (i + 1) & (tri_cap - 1);
+    }
+    if (!create) return NULL;
+    tri_slots[i].key = key;
+    tri_count++;
+    return &tri_slots[i];
+}
+
+static void tri_add(const char *text, size_t len, uint32_t seq) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        tri_post_t *t = tri_slot(tri_key(text + i), true);
+        if (t->len > t->start && t->seqs[t->len - 1] == seq) continue;
+        if (t->len == t->cap) {
+            if (t->start > t->len / 2) {
+                memmove(t->seqs, t->seqs + t->start, (t->len - t->start) * sizeof(uint32_t));
+                t->len -= t->start;
+                t->start = 0;
+            } else {
+                t->cap = t->cap ? t->cap * 2 : 4;
+                t->seqs = realloc(t->seqs, t->cap * sizeof(uint32_t));
+                if (!t->seqs) { perror("realloc"); exit(1); }
+            }
+        }
+        t->seqs[t->len++] = seq;
+    }
+}
+
+/* seq is the oldest live entry, so it can only be at the front */
+static void tri_remove(const char *text, size_t len, uint32_t seq) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        tri_post_t *t = tri_slot(tri_key(text + i), false);
+        if (t && t->len > t->start && t->seqs[t->start] == seq) t->start++;
     }
+}
 
-    printf(CLR_DARK_GRAY "└─────────────────────────────────────────────────────────────────┘\n" CLR_RESET);
+static uint32_t tri_live(const tri_post_t *t) {
+    return t ? t->len - t->start : 0;
 }
 
 /* ---------- History ---------- */
+/* In memory, a ring buffer: push is O(1) once full. On disk, every new
+   entry is appended with O_APPEND as it is pushed, so a crash loses
+   nothing and concurrent shells interleave whole lines. The file is
+   compacted to HISTFILESIZE lines (default: HISTSIZE) once it grows past
+   twice that, by writing a temp file and renaming it over the original. */
+
+static const hist_entry_t *history_at(int i) {
+    return &history[(history_head + i) % history_cap];
+}
+
+static void history_init(void) {
+    if (history) return;
+    history_cap = (int)var_long("HISTSIZE", MAX_HISTORY);
+    history = calloc((size_t)history_cap, sizeof(hist_entry_t));
+    if (!history) { perror("calloc"); exit(1); }
+}
+
+/* Ring insert only (no dedup, no disk write). owned text is freed when
+   the slot is overwritten; borrowed text (history_loaded, the snapshot)
+   lives for the whole run. */
+static void history_add(const char *text, size_t len, bool owned) {
+    history_init();
+    hist_entry_t *e;
+    if (history_count < history_cap) {
+        e = &history[(history_head + history_count++) % history_cap];
+    } else {
+        e = &history[history_head];
+        tri_remove(e->text, e->len, history_evicted++);
+        if (e->owned) free((char *)e->text);
+        history_head = (history_head + 1) % history_cap;
+    }
+    e->text = text;
+    e->len = len;
+    e->owned = owned;
+    tri_add(text, len, history_evicted + (uint32_t)history_count - 1);
+}
 
-static void load_history() {
-    char *path = get_history_path();
-    FILE *f = fopen(path, "r");
-    if (!f) { free(path); return; }
+static long history_file_limit(void) {
+    history_init();
+    return var_long("HISTFILESIZE", history_cap);
+}
+
+/* History straight from the snapshot, if the file is the one it saw */
+static bool snapshot_history_load(void) {
+    if (!snap.has_history || snap.hdr->hist_cap != (uint32_t)history_cap) return false;
+    struct stat st;
+    if (stat(get_history_path(), &st) != 0 || (uint64_t)st.st_dev != snap.hdr->hist_dev ||
+        (uint64_t)st.st_ino != snap.hdr->hist_ino || (uint64_t)st.st_size != snap.hdr->hist_size ||
+        stat_mtime_ns(&st) != snap.hdr->hist_mtime)
+        return false;
+    for (uint32_t i = 0; i < snap.nhistory; i++)
+        history_add(snap.strings + snap.history[i].off, snap.history[i].len, false);
+    history_file_lines = snap.hdr->hist_file_lines;
+    history_file_unterminated = snap.hdr->hist_unterminated;
+    history_file_st = st;
+    history_file_synced = true;
+    snap.history_used = true;
+    return true;
+}
+
+/* Map the file and walk backwards from EOF with memrchr, stopping after
+   enough lines to fill the ring and to tell whether the file is due for
+   compaction. The work is bounded by HISTSIZE/HISTFILESIZE, not by the
+   size of the file. The kept lines are then copied out and the mapping
+   dropped: another process may truncate the file, and touching a page
+   past its new end would raise SIGBUS. file_limit is HISTFILESIZE, read
+   by the caller since this may run on the loader thread. */
+static void load_history(long file_limit) {
+    history_init();
+    if (snapshot_history_load()) return;
+    int fd = open(get_history_path(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { history_file_synced = errno == ENOENT; return; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return; }
+    history_file_st = st;
+    history_file_synced = true;
+    if (st.st_size == 0) { close(fd); return; }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return;
+
+    const char *base = m;
+    const char *p = base + st.st_size;
+    if (p[-1] == '\n') p--;
+    else history_file_unterminated = true;
+
+    long want = 2 * file_limit + 1;
+    int keep = 0;
+    const char **starts = malloc((size_t)history_cap * sizeof(char *));
+    size_t *lens = malloc((size_t)history_cap * sizeof(size_t));
+    if (!starts || !lens) { perror("malloc"); exit(1); }
+
+    history_file_lines = 0;
+    while (p > base && history_file_lines < want) {
+        const char *nl = memrchr(base, '\n', (size_t)(p - base));
+        const char *start = nl ? nl + 1 : base;
+        size_t len = (size_t)(p - start);
+        if (len > 0 && start[len-1] == '\r') len--;
+        if (len > 0 && keep < history_cap) {
+            starts[keep] = start;
+            lens[keep] = len;
+            keep++;
+        }
+        history_file_lines++;
+        p = nl ? nl : base;
+    }
+    /* a line break at the very start of the file is one more line */
+    if (p > base || (p == base && *p == '\n')) history_file_lines++;
+
+    size_t total = 0;
+    for (int i = 0; i < keep; i++) total += lens[i];
+    history_loaded = malloc(total ? total : 1);
+    if (!history_loaded) { perror("malloc"); exit(1); }
+    char *q = history_loaded;
+    for (int i = keep - 1; i >= 0; i--) {
+        memcpy(q, starts[i], lens[i]);
+        history_add(q, lens[i], false);
+        q += lens[i];
+    }
+    munmap(m, (size_t)st.st_size);
+    free(starts);
+    free(lens);
+}
+
+/* Startup loads the history on a thread so the first prompt does not wait
+   for the file scan and the trigram index. Everything that reads or
+   changes the history goes through history_ensure(), which joins it. The
+   path, HISTSIZE and HISTFILESIZE are resolved before the thread starts,
+   so the loader only touches the history ring, its index and
+   history_loaded; never the variables, which every command writes.
+   A script has no prompt to hurry, so it loads in line. */
+static struct {
+    pthread_t thread;
+    bool loading;
+    long file_limit;
+    uint64_t t0, t1;    /* load span, for trace and --startup-profile */
+} history_loader;
+
+static void *history_load_main(void *arg) {
+    (void)arg;
+    history_loader.t0 = trace_now_ns();
+    load_history(history_loader.file_limit);
+    history_loader.t1 = trace_now_ns();
+    return NULL;
+}
+
+static void history_load_async(void) {
+    get_history_path();
+    history_init();
+    history_loader.file_limit = history_file_limit();
+    if (interactive) {
+        /* signals stay with the main thread */
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        history_loader.loading = pthread_create(&history_loader.thread, NULL, history_load_main, NULL) == 0;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    if (!history_loader.loading) {
+        history_load_main(NULL);
+        trace_span("load_history", history_loader.t0, history_loader.t1, NULL);
+    }
+}
+
+static void history_ensure(void) {
+    if (!history_loader.loading) return;
+    pthread_join(history_loader.thread, NULL);
+    history_loader.loading = false;
+    trace_span("load_history", history_loader.t0, history_loader.t1, "background");
+}
+
+/* Whether st is the file the ring last saw, grown only by our own write
+   of the given size */
+static bool history_file_matches(const struct stat *st, ssize_t grew) {
+    if (history_file_st.st_ino == 0) return st->st_size == grew;
+    return st->st_dev == history_file_st.st_dev && st->st_ino == history_file_st.st_ino &&
+           st->st_size == history_file_st.st_size + grew;
+}
+
+/* Rewrite the file down to its newest HISTFILESIZE lines. Holds an
+   exclusive lock so appenders in other shells wait and then notice the
+   renamed file. */
+static void history_compact(void) {
+    const char *path = get_history_path();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !history_file_matches(&st, 0)) history_file_synced = false;
+    FILE *in = fdopen(fd, "r");
+    if (!in) { close(fd); return; }     /* also drops the lock */
+    long limit = history_file_limit();
+    char **tail = calloc((size_t)limit, sizeof(char *));
+    long n = 0;
     char *line = NULL;
-    size_t len=0;
+    size_t len = 0;
     ssize_t r;
-    while ((r=getline(&line,&len,f))!=-1) {
-        if (r>0 && (line[r-1]=='\n' || line[r-1]=='\r')) line[--r]=0;
-        if (history_count < MAX_HISTORY) history[history_count++] = strdup_safe(line);
+    while (tail && (r = getline(&line, &len, in)) != -1) {
+        free(tail[n % limit]);
+        tail[n % limit] = strdup_safe(line);
+        n++;
     }
     free(line);
-    fclose(f);
-    free(path);
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, (int)getpid());
+    FILE *out = tail ? fopen(tmp, "w") : NULL;
+    if (out) {
+        long first = n > limit ? n - limit : 0;
+        for (long i = first; i < n; i++) fputs(tail[i % limit], out);
+        if (fclose(out) == 0 && rename(tmp, path) == 0) {
+            history_file_lines = n - first;
+            if (stat(path, &st) == 0) history_file_st = st;
+            else history_file_synced = false;
+        } else unlink(tmp);
+    }
+
+    if (tail) for (long i = 0; i < limit; i++) free(tail[i]);
+    free(tail);
+    fclose(in);     /* also drops the lock */
 }
 
-static void save_history() {
-    char *path = get_history_path();
-    FILE *f = fopen(path, "w");
-    if (!f) { free(path); return; }
-    int start = history_count > MAX_HISTORY ? history_count - MAX_HISTORY : 0;
-    for (int i=start;i<history_count;i++) {
-        fprintf(f, "%s\n", history[i]);
+/* Append one entry in a single O_APPEND write. The shared lock keeps us
+   out of a running compaction; if it renamed the file while we waited,
+   reopen and append to the new one. */
+static void history_append_file(const char *line) {
+    const char *path = get_history_path();
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) break;
+        flock(fd, LOCK_SH);
+        struct stat a, b;
+        if (attempt == 0 && fstat(fd, &a) == 0 &&
+            (stat(path, &b) != 0 || a.st_ino != b.st_ino || a.st_dev != b.st_dev)) {
+            close(fd);
+            continue;
+        }
+        struct iovec iov[3] = {
+            { .iov_base = "\n", .iov_len = history_file_unterminated },
+            { .iov_base = (void *)line, .iov_len = strlen(line) },
+            { .iov_base = "\n", .iov_len = 1 },
+        };
+        ssize_t w = writev(fd, iov, 3);
+        if (w > 0) history_file_lines++;
+        if (w < 0 || fstat(fd, &a) != 0 || !history_file_matches(&a, w)) history_file_synced = false;
+        else history_file_st = a;
+        history_file_unterminated = false;
+        close(fd);
+        break;
     }
-    fclose(f);
-    free(path);
+
+    if (history_file_lines > 2 * history_file_limit()) history_compact();
+}
+
+/* Entries are already on disk; only trim the file if it is oversized */
+static void save_history() {
+    history_ensure();
+    if (history_file_lines > history_file_limit()) history_compact();
 }
 
 static void push_history(const char *line) {
     if (!line || !*line) return;
-    if (history_count>0 && strcmp(history[history_count-1], line)==0) return;
-    if (history_count < MAX_HISTORY) history[history_count++] = strdup_safe(line);
-    else {
-        free(history[0]);
-        memmove(&history[0], &history[1], sizeof(char*)*(MAX_HISTORY-1));
-        history[MAX_HISTORY-1] = strdup_safe(line);
+    history_ensure();
+    size_t len = strlen(line);
+    if (history_count>0) {
+        const hist_entry_t *last = history_at(history_count-1);
+        if (last->len == len && memcmp(last->text, line, len) == 0) return;
+    }
+    history_add(strdup_safe(line), len, true);
+    history_append_file(line);
+}
+
+/* Search flags */
+#define HS_ICASE   1
+#define HS_PREFIX  2
+
+typedef struct {
+    int index;          /* newest occurrence (history_at index) */
+    int count;          /* occurrences of the same text */
+    long score;
+    uint32_t hash;
+} hist_match_t;
+
+static bool hist_text_match(const hist_entry_t *e, const char *term, size_t tlen, int flags) {
+    if (tlen > e->len) return false;
+    if (!(flags & HS_ICASE)) {
+        if (flags & HS_PREFIX) return memcmp(e->text, term, tlen) == 0;
+        return memmem(e->text, e->len, term, tlen) != NULL;
+    }
+    size_t last = (flags & HS_PREFIX) ? 0 : e->len - tlen;
+    for (size_t i = 0; i <= last; i++) {
+        if (strncasecmp(e->text + i, term, tlen) == 0) return true;
+    }
+    return false;
+}
+
+static int hist_match_cmp(const void *a, const void *b) {
+    const hist_match_t *x = a, *y = b;
+    if (x->score != y->score) return x->score > y->score ? -1 : 1;
+    return y->index - x->index;
+}
+
+/* Frecency: each occurrence counts more the more recent it is: 16 within
+   the newest 64 entries, halving at 256, 1024 and 4096 entries back, and
+   1 beyond that. */
+static long hist_weight(int age) {
+    if (age < 64) return 16;
+    if (age < 256) return 8;
+    if (age < 1024) return 4;
+    if (age < 4096) return 2;
+    return 1;
+}
+
+/* Find entries containing (or starting with) term. Duplicate texts are
+   folded into one result; results are sorted best first. Returns the
+   number of matches, *out must be freed; *visited gets the number of
+   entries that were actually compared. */
+static int history_search(const char *term, int flags, hist_match_t **out, long *visited) {
+    history_ensure();
+    size_t tlen = strlen(term);
+    *out = NULL;
+    *visited = 0;
+    if (history_count == 0) return 0;
+
+    /* candidates: shortest posting list among the term's trigrams */
+    const tri_post_t *best = NULL;
+    bool indexed = tlen >= 3;
+    for (size_t i = 0; indexed && i + 3 <= tlen; i++) {
+        const tri_post_t *t = tri_slot(tri_key(term + i), false);
+        if (!t || tri_live(t) == 0) return 0;
+        if (!best || tri_live(t) < tri_live(best)) best = t;
+    }
+    long ncand = indexed ? (long)tri_live(best) : history_count;
+
+    int cap = 64, n = 0;
+    hist_match_t *m = malloc((size_t)cap * sizeof(hist_match_t));
+    /* text hash -> match slot, open addressing; size a power of two > 2*ncand */
+    uint32_t tcap = 16;
+    while (tcap < (uint32_t)ncand * 2) tcap <<= 1;
+    int *table = malloc(tcap * sizeof(int));
+    if (!m || !table) { perror("malloc"); exit(1); }
+    memset(table, -1, tcap * sizeof(int));
+
+    /* newest first, so the first occurrence seen is the one to report */
+    for (long c = ncand - 1; c >= 0; c--) {
+        int idx = indexed ? (int)(best->seqs[best->start + c] - history_evicted) : (int)c;
+        const hist_entry_t *e = history_at(idx);
+        (*visited)++;
+        if (!hist_text_match(e, term, tlen, flags)) continue;
+
+        uint32_t h = mem_hash(e->text, e->len);
+        uint32_t j = h & (tcap - 1);
+        while (table[j] >= 0) {
+            const hist_entry_t *o = history_at(m[table[j]].index);
+            if (m[table[j]].hash == h && o->len == e->len && memcmp(o->text, e->text, e->len) == 0) break;
+            j = (j + 1) & (tcap - 1);
+        }
+        long w = hist_weight(history_count - 1 - idx);
+        if (table[j] >= 0) {
+            m[table[j]].count++;
+            m[table[j]].score += w;
+            continue;
+        }
+        if (n == cap) {
+            cap *= 2;
+            m = realloc(m, (size_t)cap * sizeof(hist_match_t));
+            if (!m) { perror("realloc"); exit(1); }
+        }
+        m[n] = (hist_match_t){ .index = idx, .count = 1, .score = w, .hash = h };
+        table[j] = n++;
     }
+    free(table);
+
+    qsort(m, (size_t)n, sizeof(hist_match_t), hist_match_cmp);
+    *out = m;
+    return n;
 }
 
 /* ---------- Signals & handlers ---------- */
 
-static void sigchld_handler(int sig) {
-    (void)sig;
+/* Drain the signalfd and collect every child that changed state. No
+   handler ever runs, so the job table only changes here. */
+static void reap_children(void) {
+    struct signalfd_siginfo drain[8];
+    while (read(sigchld_fd, drain, sizeof(drain)) > 0) {}
+
     int status;
     pid_t pid;
-
     while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        for (int i = 0; i < jobs_count; i++) {
-            if (jobs[i].pgid > 0) {
-                if (pid == jobs[i].pgid || getpgid(pid) == jobs[i].pgid) {
-                    if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                        jobs[i].state = JOB_DONE;
-                        printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "JOB COMPLETED" CLR_DARK_GRAY "] "
-                               CLR_LIGHT_GRAY "Job [%d] finished\n" CLR_RESET, jobs[i].id);
-                    } else if (WIFSTOPPED(status)) {
-                        jobs[i].state = JOB_STOPPED;
-                    } else if (WIFCONTINUED(status)) {
-                        jobs[i].state = JOB_RUNNING;
-                    }
-                    break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            job_t *j = pid_job_take(pid);
+            if (j && job_member_exited(j, pid, status) && !j->quiet) {
+                if (job_notice_count == job_notice_cap) {
+                    job_notice_cap = job_notice_cap ? job_notice_cap * 2 : 16;
+                    job_notices = realloc(job_notices, sizeof(int) * (size_t)job_notice_cap);
+                    if (!job_notices) { perror("realloc"); exit(1); }
                 }
+                job_notices[job_notice_count++] = j->id;
             }
+            continue;
         }
+        job_t *j = pid_job_get(pid);
+        if (!j) continue;
+        if (WIFSTOPPED(status)) set_job_state(j, JOB_STOPPED);
+        else if (WIFCONTINUED(status)) set_job_state(j, JOB_RUNNING);
+    }
+}
+
+static void print_job_notices(void) {
+    for (int i = 0; i < job_notice_count; i++) {
+        out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "JOB COMPLETED" CLR_DARK_GRAY "] "
+               CLR_LIGHT_GRAY "Job [%d] finished\n" CLR_RESET, job_notices[i]);
     }
+    job_notice_count = 0;
+}
+
+static void block_sigchld(void) {
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
 }
 
 static void setup_signals() {
-    struct sigaction sa;
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-    if (sigaction(SIGCHLD, &sa, NULL) == -1) perror("sigaction(SIGCHLD)");
+    /* children get an empty mask from both spawn paths */
+    block_sigchld();
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigchld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd < 0) { perror("signalfd"); exit(1); }
 
     signal(SIGTTOU, SIG_IGN);
     signal(SIGTTIN, SIG_IGN);
@@ -717,201 +2346,1027 @@ static void forward_signal_to_fg(int signo) {
     if (fg_pgid > 0) kill(-fg_pgid, signo);
 }
 
-static void sigint_handler(int signo) { (void)signo; forward_signal_to_fg(SIGINT); }
+/* Set on SIGINT; long-running builtins (parallel) poll it */
+static volatile sig_atomic_t got_sigint = 0;
+
+static void sigint_handler(int signo) { (void)signo; got_sigint = 1; forward_signal_to_fg(SIGINT); }
 static void sigtstp_handler(int signo) { (void)signo; forward_signal_to_fg(SIGTSTP); }
 
-/* ---------- Parsing structures ---------- */
+/* ---------- Event loop ---------- */
+/* While the shell waits at the prompt, one epoll set holding the terminal
+   and sigchld_fd is its only wakeup source: a background job that ends
+   mid-edit is reported at once and the prompt redrawn around the line
+   being typed, rather than at the next Enter. Foreground jobs are still
+   waited for with wait4, which blocks just as well and is the only call
+   that hands back each stage's rusage. */
+
+enum { EV_INPUT = 1, EV_CHILD = 2 };
+
+static int ev_fd = -1;
+
+static void ev_init(void) {
+    ev_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev_fd < 0) return;      /* ev_wait then reports input only */
+    struct epoll_event e = { .events = EPOLLIN, .data.u32 = EV_INPUT };
+    struct epoll_event c = { .events = EPOLLIN, .data.u32 = EV_CHILD };
+    if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, STDIN_FILENO, &e) < 0 ||
+        epoll_ctl(ev_fd, EPOLL_CTL_ADD, sigchld_fd, &c) < 0) {
+        close(ev_fd);
+        ev_fd = -1;
+    }
+}
+
+/* Sleep until something is ready; returns the EV_* bits that are */
+static int ev_wait(void) {
+    if (ev_fd < 0) return EV_INPUT;
+    struct epoll_event evs[2];
+    int n;
+    do n = epoll_wait(ev_fd, evs, 2, -1); while (n < 0 && errno == EINTR);
+    if (n < 0) return EV_INPUT;
+    int ready = 0;
+    for (int i = 0; i < n; i++) ready |= (int)evs[i].data.u32;
+    return ready;
+}
+
+/* ---------- Directory cache ---------- */
+/* Sorted listings of directories keyed by path, shared by glob expansion
+   and tab completion. A listing is reused without a stat for the rest of
+   the current command (dir_cache_gen), then revalidated against the
+   directory's inode and mtime. A listing read in the same second the
+   directory was last modified is not trusted, since a later change within
+   that second would leave the mtime unchanged. */
+
+#define DIR_CACHE_MAX 512
 
 typedef struct {
-    char *argv[MAX_ARGS];
-    int argc;
-    char *infile;
-    char *outfile;
-    bool append;
-} cmd_t;
+    const char *name;
+    unsigned char type;     /* d_type, DT_UNKNOWN on some filesystems */
+} dir_entry_t;
 
 typedef struct {
-    cmd_t cmds[16];
-    int ncmds;
-    bool background;
-} pipeline_t;
+    char *path;
+    dir_entry_t *ents;      /* sorted by strcmp */
+    int count;
+    char *names;            /* storage for every entry name */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    time_t read_at;
+    unsigned gen;
+    unsigned long version;  /* unique per read, for indexes built on top */
+} dir_listing_t;
+
+static strmap_t dir_cache;
+static dir_listing_t **dir_listings;
+static int dir_listings_count, dir_listings_cap;
+static unsigned dir_cache_gen = 1;
+static unsigned dir_cache_swept = 0;    /* gen of the last eviction sweep */
+static unsigned long dir_listing_serial = 0;
+
+
+static int dir_entry_cmp(const void *a, const void *b) {
+    return strcmp(((const dir_entry_t *)a)->name, ((const dir_entry_t *)b)->name);
+}
 
-/* ---------- Tokenizer ---------- */
-/* Handles quotes, escapes, and environment expansion. Returns an array of
-   dynamically-allocated strings and sets ntoks_out. Caller must free. */
+static void dir_listing_free(dir_listing_t *l) {
+    free(l->path);
+    free(l->ents);
+    free(l->names);
+    free(l);
+}
 
-static char **tokenize(const char *line, int *ntoks_out) {
-    char **toks = calloc(MAX_TOKENS, sizeof(char*));
-    int ti = 0;
-    const char *p = line;
-    while (*p) {
-        while (isspace((unsigned char)*p)) p++;
-        if (!*p) break;
-        char buf[4096]; int bi = 0;
-        if (*p == '"' || *p == '\'') {
-            char quote = *p++;
-            while (*p && *p != quote) {
-                if (*p == '\\' && quote == '"' && *(p+1)) {
-                    p++;
-                    if (bi < (int)sizeof(buf)-1) buf[bi++] = *p++;
-                } else {
-                    if (bi < (int)sizeof(buf)-1) buf[bi++] = *p++;
-                }
-            }
-            if (*p == quote) p++;
-        } else {
-            while (*p && !isspace((unsigned char)*p)) {
-                if (*p == '\\' && *(p+1)) { p++; if (bi < (int)sizeof(buf)-1) buf[bi++] = *p++; }
-                else { if (bi < (int)sizeof(buf)-1) buf[bi++] = *p++; }
-            }
-        }
-        buf[bi] = '\0';
+static void dir_cache_drop(dir_listing_t *l) {
+    strmap_del(&dir_cache, l->path);
+    ptr_array_remove((void **)dir_listings, &dir_listings_count, l);
+    dir_listing_free(l);
+}
 
-        char *expanded = expand_env_vars(buf);
-        toks[ti++] = expanded;
-        if (ti >= MAX_TOKENS-1) break;
-    }
-    toks[ti] = NULL;
-    *ntoks_out = ti;
-    return toks;
+static void dir_cache_clear(void) {
+    for (int i = 0; i < dir_listings_count; i++) dir_listing_free(dir_listings[i]);
+    dir_listings_count = 0;
+    strmap_clear(&dir_cache);
 }
 
-/* ---------- Parse tokens into pipeline_t ---------- */
+/* Start of a new command: cached listings get revalidated on next use */
+static void dir_cache_tick(void) {
+    dir_cache_gen++;
+    if (dir_listings_count > DIR_CACHE_MAX) dir_cache_clear();
+}
 
-static pipeline_t parse_tokens(char **toks, int ntoks) {
-    pipeline_t pipe = { .ncmds = 0, .background = false };
-    cmd_t cur = { .argc = 0, .infile = NULL, .outfile = NULL, .append = false };
-    int i = 0;
-    while (i < ntoks) {
-        char *t = toks[i];
-        if (strcmp(t, "|") == 0) {
-            cur.argv[cur.argc] = NULL;
-            pipe.cmds[pipe.ncmds++] = cur;
-            cur = (cmd_t){ .argc=0, .infile=NULL, .outfile=NULL, .append=false };
-            i++;
-        } else if (strcmp(t, "<") == 0) {
-            if (i+1 < ntoks) { cur.infile = strdup_safe(toks[i+1]); i+=2; }
-            else { i++; }
-        } else if (strcmp(t, ">") == 0) {
-            if (i+1 < ntoks) { cur.outfile = strdup_safe(toks[i+1]); cur.append=false; i+=2; }
-            else { i++; }
-        } else if (strcmp(t, ">>") == 0) {
-            if (i+1 < ntoks) { cur.outfile = strdup_safe(toks[i+1]); cur.append=true; i+=2; }
-            else { i++; }
-        } else if (strcmp(t, "&") == 0) {
-            pipe.background = true; i++;
+/* Over DIR_CACHE_MAX mid-command: drop listings from earlier commands.
+   The current command's stay valid while a glob walks them, so one huge
+   glob can still exceed the limit until the next tick. Nothing older
+   can appear later in the same generation, so sweep once per gen. */
+static void dir_cache_evict(void) {
+    if (dir_listings_count < DIR_CACHE_MAX || dir_cache_swept == dir_cache_gen) return;
+    dir_cache_swept = dir_cache_gen;
+    int kept = 0;
+    for (int i = 0; i < dir_listings_count; i++) {
+        dir_listing_t *l = dir_listings[i];
+        if (l->gen == dir_cache_gen) {
+            dir_listings[kept++] = l;
         } else {
-            if (cur.argc < MAX_ARGS-1) cur.argv[cur.argc++] = strdup_safe(t);
-            i++;
+            strmap_del(&dir_cache, l->path);
+            dir_listing_free(l);
         }
     }
-    if (cur.argc > 0 || cur.infile || cur.outfile) {
-        cur.argv[cur.argc] = NULL;
-        pipe.cmds[pipe.ncmds++] = cur;
-    }
-    return pipe;
+    dir_listings_count = kept;
 }
 
-/* Free tokenizer results */
-static void free_tokens(char **toks, int ntoks) {
-    for (int i=0;i<ntoks;i++) free(toks[i]);
-    free(toks);
+static dir_listing_t *dir_read(const char *path, const struct stat *st) {
+    DIR *d = opendir(path);
+    if (!d) return NULL;
+    dir_listing_t *l = calloc(1, sizeof(*l));
+    if (!l) { perror("calloc"); exit(1); }
+    size_t len = 0, cap = 0;
+    int ents_cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        const char *n = e->d_name;
+        if (n[0] == '.' && (!n[1] || (n[1] == '.' && !n[2]))) continue;
+        size_t nl = strlen(n) + 1;
+        if (len + nl > cap) {
+            cap = cap ? cap * 2 : 4096;
+            while (len + nl > cap) cap *= 2;
+            char *grown = realloc(l->names, cap);
+            if (!grown) { perror("realloc"); exit(1); }
+            l->names = grown;
+        }
+        if (l->count == ents_cap) {
+            ents_cap = ents_cap ? ents_cap * 2 : 64;
+            dir_entry_t *grown = realloc(l->ents, sizeof(dir_entry_t) * (size_t)ents_cap);
+            if (!grown) { perror("realloc"); exit(1); }
+            l->ents = grown;
+        }
+        memcpy(l->names + len, n, nl);
+        /* offsets until the name storage stops moving */
+        l->ents[l->count].name = (const char *)(uintptr_t)len;
+        l->ents[l->count].type = e->d_type;
+        l->count++;
+        len += nl;
+    }
+    closedir(d);
+    for (int i = 0; i < l->count; i++) l->ents[i].name = l->names + (uintptr_t)l->ents[i].name;
+    if (l->count > 1) qsort(l->ents, (size_t)l->count, sizeof(dir_entry_t), dir_entry_cmp);
+
+    l->path = strdup_safe(path);
+    l->dev = st->st_dev;
+    l->ino = st->st_ino;
+    l->mtime = st->st_mtim;
+    l->read_at = time(NULL);
+    l->version = ++dir_listing_serial;
+    return l;
 }
 
-/* ---------- Builtins ---------- */
+/* Cached listing of path ("" is the cwd), or NULL if it cannot be read */
+static const dir_listing_t *dir_listing(const char *path) {
+    if (!*path) path = ".";
+    dir_listing_t *l = strmap_get(&dir_cache, path);
+    if (l && l->gen == dir_cache_gen) return l;
 
-/* cd with tilde expansion */
-static int builtin_cd(int argc, char **argv) {
-    const char *path;
-    if (argc < 2) path = getenv("HOME");
-    else path = argv[1];
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        if (l) dir_cache_drop(l);
+        return NULL;
+    }
+    if (l && l->dev == st.st_dev && l->ino == st.st_ino &&
+        l->mtime.tv_sec == st.st_mtim.tv_sec && l->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+        l->read_at > st.st_mtim.tv_sec) {
+        l->gen = dir_cache_gen;
+        return l;
+    }
 
-    char *expanded = expand_tilde(path);
-    if (chdir(expanded) != 0) {
-        print_cyberpunk_error("cd: Directory not found");
-        free(expanded);
-        return 1;
+    if (l) dir_cache_drop(l);
+    l = dir_read(path, &st);
+    if (!l) return NULL;
+    dir_cache_evict();
+    ptr_array_push((void ***)&dir_listings, &dir_listings_count, &dir_listings_cap, l);
+    strmap_put(&dir_cache, l->path, l);
+    l->gen = dir_cache_gen;
+    return l;
+}
+
+/* Index of the first entry >= prefix; entries starting with prefix follow */
+static int dir_lower_bound(const dir_listing_t *l, const char *prefix, size_t n) {
+    int lo = 0, hi = l->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(l->ents[mid].name, prefix, n) < 0) lo = mid + 1;
+        else hi = mid;
     }
-    free(expanded);
-    return 0;
+    return lo;
 }
 
-/* exit (saves state before quitting) */
-static int builtin_exit(int argc, char **argv) {
-    (void)argc; (void)argv;
-    save_history();
-    save_persistent_data();
+static const dir_entry_t *dir_find(const dir_listing_t *l, const char *name) {
+    int i = dir_lower_bound(l, name, strlen(name) + 1);
+    return i < l->count && strcmp(l->ents[i].name, name) == 0 ? &l->ents[i] : NULL;
+}
 
-    printf("\n");
-    print_header_border("🛑 SESSION TERMINATED 🛑");
-    printf(CLR_NEON_GREEN "         Neural interface disconnecting • Goodbye!\n" CLR_RESET);
-    printf("\n");
+/* d_type of an entry, falling back to lstat where the filesystem has none */
+static unsigned char dir_entry_type(const char *dir, const dir_entry_t *e) {
+    if (e->type != DT_UNKNOWN) return e->type;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", *dir ? dir : ".", e->name);
+    struct stat st;
+    if (lstat(path, &st) < 0) return DT_UNKNOWN;
+    return S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+}
 
-    exit(0);
-    return 0;
+/* ---------- Glob expansion ---------- */
+/* *, ?, [...] ([!...] and ranges) and a ** segment for any number of
+   directories. The lexer hands over patterns with quoted metacharacters
+   backslash-escaped. Each path segment is compiled once into ops; its
+   literal prefix narrows the sorted listing by binary search before the
+   ops run. Like sh, wildcards do not match a leading '.', and a pattern
+   that matches nothing stays as typed. */
+
+typedef enum { GLOB_LIT, GLOB_ANY, GLOB_STAR, GLOB_CLASS } glob_kind_t;
+
+typedef struct {
+    unsigned char kind, ch;
+    const uint8_t *set;     /* GLOB_CLASS: 256-bit membership */
+} glob_op_t;
+
+typedef struct {
+    glob_op_t *ops;
+    int nops;
+    char *prefix;           /* leading literal text */
+    size_t prefix_len;
+    bool literal;           /* no wildcard at all */
+    bool globstar;          /* the segment is exactly ** */
+} glob_seg_t;
+
+
+/* Pattern text back to the word it was typed as */
+static char *glob_unescape(const char *s) {
+    size_t n = strlen(s);
+    char *r = arena_alloc(&line_arena, n + 1), *d = r;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) s++;
+        *d++ = *s;
+    }
+    *d = '\0';
+    return r;
 }
 
-static int builtin_mkdir(int argc, char **argv) {
-    if (argc < 2) {
-        print_cyberpunk_error("mkdir: missing operand");
-        return 1;
+/* [...] starting at p (just past '['); returns the end or NULL if unclosed */
+static const char *glob_parse_class(const char *p, const char *end, uint8_t *set) {
+    bool negate = (p < end && (*p == '!' || *p == '^'));
+    if (negate) p++;
+    memset(set, 0, 32);
+    bool first = true;
+    while (p < end && (*p != ']' || first)) {
+        unsigned char lo = (unsigned char)*p;
+        if (lo == '\\' && p + 1 < end) lo = (unsigned char)*++p;
+        p++;
+        unsigned char hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            hi = (unsigned char)p[1];
+            if (hi == '\\' && p + 2 < end) { hi = (unsigned char)p[2]; p++; }
+            p += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) set[c >> 3] |= (uint8_t)(1u << (c & 7));
+        first = false;
     }
-    for (int i=1;i<argc;i++) {
-        if (mkdir(argv[i], 0755) != 0) {
-            print_cyberpunk_error("mkdir: Failed to create directory");
+    if (p >= end) return NULL;
+    if (negate) for (int i = 0; i < 32; i++) set[i] = (uint8_t)~set[i];
+    set[0] &= (uint8_t)~1u;      /* never NUL */
+    return p + 1;
+}
+
+static void glob_compile(const char *p, const char *end, glob_seg_t *seg) {
+    *seg = (glob_seg_t){0};
+    seg->globstar = (end - p == 2 && p[0] == '*' && p[1] == '*');
+    seg->ops = arena_alloc(&line_arena, sizeof(glob_op_t) * (size_t)(end - p + 1));
+    seg->prefix = arena_alloc(&line_arena, (size_t)(end - p + 1));
+    bool in_prefix = true;
+    while (p < end) {
+        glob_op_t op = { .kind = GLOB_LIT, .ch = (unsigned char)*p };
+        if (*p == '\\' && p + 1 < end) {
+            op.ch = (unsigned char)*++p;
+            p++;
+        } else if (*p == '?') {
+            op.kind = GLOB_ANY;
+            p++;
+        } else if (*p == '*') {
+            op.kind = GLOB_STAR;
+            while (p < end && *p == '*') p++;
+        } else if (*p == '[') {
+            uint8_t *set = arena_alloc(&line_arena, 32);
+            const char *q = glob_parse_class(p + 1, end, set);
+            if (q) { op.kind = GLOB_CLASS; op.set = set; p = q; }
+            else p++;       /* unclosed: a literal '[' */
         } else {
-            printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "CREATED" CLR_DARK_GRAY "] " CLR_RESET "Directory: %s\n", argv[i]);
+            p++;
         }
+        if (op.kind != GLOB_LIT) in_prefix = false;
+        else if (in_prefix) seg->prefix[seg->prefix_len++] = (char)op.ch;
+        seg->ops[seg->nops++] = op;
     }
-    return 0;
+    seg->prefix[seg->prefix_len] = '\0';
+    seg->literal = in_prefix;
 }
 
-static int builtin_touch(int argc, char **argv) {
-    if (argc < 2) {
-        print_cyberpunk_error("touch: missing file operand");
-        return 1;
+/* Wildcard matching with single-star backtracking: linear in practice */
+static bool glob_match(const glob_seg_t *seg, const char *s) {
+    const glob_op_t *ops = seg->ops;
+    int pi = 0, star = -1;
+    const char *star_s = NULL;
+    if (*s == '.' && !(seg->nops > 0 && ops[0].kind == GLOB_LIT && ops[0].ch == '.')) return false;
+    while (*s) {
+        if (pi < seg->nops) {
+            const glob_op_t *o = &ops[pi];
+            unsigned char c = (unsigned char)*s;
+            if (o->kind == GLOB_STAR) { star = pi++; star_s = s; continue; }
+            if ((o->kind == GLOB_LIT && o->ch == c) || o->kind == GLOB_ANY ||
+                (o->kind == GLOB_CLASS && (o->set[c >> 3] & (1u << (c & 7))))) {
+                pi++;
+                s++;
+                continue;
+            }
+        }
+        if (star < 0) return false;
+        pi = star + 1;
+        s = ++star_s;
     }
-    for (int i=1;i<argc;i++) {
-        int fd = open(argv[i], O_CREAT|O_WRONLY, 0644);
-        if (fd < 0) {
-            print_cyberpunk_error("touch: Failed to create file");
+    while (pi < seg->nops && ops[pi].kind == GLOB_STAR) pi++;
+    return pi == seg->nops;
+}
+
+static void glob_emit(strvec_t *out, const char *base, const char *name, bool slash) {
+    size_t bl = strlen(base), nl = strlen(name);
+    char *r = arena_alloc(&line_arena, bl + nl + 2);
+    memcpy(r, base, bl);
+    memcpy(r + bl, name, nl);
+    if (slash) r[bl + nl++] = '/';
+    r[bl + nl] = '\0';
+    strvec_push(out, r);
+}
+
+static char *glob_join(const char *base, const char *name) {
+    size_t bl = strlen(base), nl = strlen(name);
+    char *r = arena_alloc(&line_arena, bl + nl + 2);
+    memcpy(r, base, bl);
+    memcpy(r + bl, name, nl);
+    r[bl + nl] = '/';
+    r[bl + nl + 1] = '\0';
+    return r;
+}
+
+/* Match segs[si..] below base ("" or a path ending in '/') */
+static void glob_walk(const char *base, const glob_seg_t *segs, int nsegs, int si,
+                      bool dirs_only, strvec_t *out) {
+    const glob_seg_t *seg = &segs[si];
+    bool last = (si == nsegs - 1);
+
+    if (seg->literal && !seg->globstar) {
+        if (!last) { glob_walk(glob_join(base, seg->prefix), segs, nsegs, si + 1, dirs_only, out); return; }
+        const dir_listing_t *l = dir_listing(base);
+        const dir_entry_t *e = l ? dir_find(l, seg->prefix) : NULL;
+        if (!e) return;
+        if (dirs_only && dir_entry_type(base, e) != DT_DIR && dir_entry_type(base, e) != DT_LNK) return;
+        glob_emit(out, base, seg->prefix, dirs_only);
+        return;
+    }
+
+    if (seg->globstar && !last) glob_walk(base, segs, nsegs, si + 1, dirs_only, out);
+
+    const dir_listing_t *l = dir_listing(base);
+    if (!l) return;
+    int from = seg->prefix_len ? dir_lower_bound(l, seg->prefix, seg->prefix_len) : 0;
+    for (int i = from; i < l->count; i++) {
+        const dir_entry_t *e = &l->ents[i];
+        if (seg->prefix_len && strncmp(e->name, seg->prefix, seg->prefix_len) != 0) break;
+        if (seg->globstar) {
+            if (e->name[0] == '.') continue;
+            unsigned char type = dir_entry_type(base, e);
+            if (last && (!dirs_only || type == DT_DIR)) glob_emit(out, base, e->name, dirs_only);
+            /* ** does not follow symlinks, so it cannot loop */
+            if (type == DT_DIR) glob_walk(glob_join(base, e->name), segs, nsegs, si, dirs_only, out);
+            continue;
+        }
+        if (!glob_match(seg, e->name)) continue;
+        if (last) {
+            if (dirs_only) {
+                unsigned char type = dir_entry_type(base, e);
+                if (type != DT_DIR && type != DT_LNK) continue;
+            }
+            glob_emit(out, base, e->name, dirs_only);
         } else {
-            close(fd);
-            printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "CREATED" CLR_DARK_GRAY "] " CLR_RESET "File: %s\n", argv[i]);
+            unsigned char type = dir_entry_type(base, e);
+            if (type == DT_DIR || type == DT_LNK)
+                glob_walk(glob_join(base, e->name), segs, nsegs, si + 1, dirs_only, out);
         }
     }
-    return 0;
 }
 
-static int builtin_clear(int argc, char **argv) {
-    (void)argc; (void)argv;
-    printf("\033[H\033[2J");
-    fflush(stdout);
-    return 0;
+static int glob_path_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
 }
 
-static int builtin_help(int argc, char **argv) {
-    (void)argc; (void)argv;
+/* Expand an escaped pattern into sorted paths; returns their count */
+static int glob_expand(const char *pattern, strvec_t *out) {
+    *out = (strvec_t){0};
+    const char *p = pattern;
+    const char *base = "";
+    if (*p == '/') { base = "/"; while (*p == '/') p++; }
 
-    printf("\n");
-    print_header_border("🎮 CYBER-COMMANDS 🎮");
-    printf("\n");
+    int nsegs = 0, cap = 8;
+    glob_seg_t *segs = arena_alloc(&line_arena, sizeof(glob_seg_t) * (size_t)cap);
+    bool dirs_only = false;
+    while (*p) {
+        const char *end = p;
+        while (*end && *end != '/') end += (*end == '\\' && end[1]) ? 2 : 1;
+        if (nsegs == cap) {
+            segs = arena_grow(&line_arena, segs, sizeof(glob_seg_t) * (size_t)cap, sizeof(glob_seg_t) * (size_t)cap * 2);
+            cap *= 2;
+        }
+        glob_compile(p, end, &segs[nsegs++]);
+        p = end;
+        if (*p == '/') {
+            while (*p == '/') p++;
+            if (!*p) dirs_only = true;
+        }
+    }
+    if (nsegs == 0) return 0;
 
-    printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "│" CLR_NEON_GREEN "                         CORE COMMANDS                          " CLR_DARK_GRAY "│\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    glob_walk(base, segs, nsegs, 0, dirs_only, out);
+    if (out->n > 1) qsort(out->v, (size_t)out->n, sizeof(char *), glob_path_cmp);
+    return out->n;
+}
 
-    print_content_line("cd [dir]", "Navigate directories (cd ~ for home)");
+/* ---------- Parsing structures ---------- */
+
+/* argv and cmds are grown in line_arena; argv is always NULL-terminated
+   once cmd_push_arg has been called. */
+typedef struct {
+    char **argv;
+    int argc, argv_cap;
+    char *infile;
+    char *outfile;
+    bool append;
+} cmd_t;
+
+typedef struct {
+    cmd_t *cmds;
+    int ncmds, cmds_cap;
+    bool background;
+    bool quiet;         /* background without notices or loading bar */
+} pipeline_t;
+
+/* A command list: pipelines joined by ; && || (or ended by &), run left
+   to right with equal precedence as in sh. Items keep their source text
+   and are lexed only when they run, so expansions and globs see what the
+   commands before them did, and a short-circuited item is never lexed. */
+typedef enum { LIST_SEQ, LIST_AND, LIST_OR } list_op_t;
+
+typedef struct {
+    char *text;         /* one pipeline, in line_arena (or the line itself) */
+    list_op_t op;       /* how it depends on the status so far */
+} list_item_t;
+
+typedef struct {
+    list_item_t *items;
+    int n, cap;
+} cmd_list_t;
+
+static void cmd_push_arg(cmd_t *c, char *word) {
+    if (c->argc + 2 > c->argv_cap) {
+        int cap = c->argv_cap ? c->argv_cap * 2 : 8;
+        c->argv = arena_grow(&line_arena, c->argv, sizeof(char *) * (size_t)c->argv_cap,
+                             sizeof(char *) * (size_t)cap);
+        c->argv_cap = cap;
+    }
+    c->argv[c->argc++] = word;
+    c->argv[c->argc] = NULL;
+}
+
+/* Append a copy of c (whose argv may still be unallocated) to pl */
+static cmd_t *pipeline_push_cmd(pipeline_t *pl, const cmd_t *c) {
+    if (pl->ncmds == pl->cmds_cap) {
+        int cap = pl->cmds_cap ? pl->cmds_cap * 2 : 4;
+        pl->cmds = arena_grow(&line_arena, pl->cmds, sizeof(cmd_t) * (size_t)pl->cmds_cap,
+                              sizeof(cmd_t) * (size_t)cap);
+        pl->cmds_cap = cap;
+    }
+    cmd_t *d = &pl->cmds[pl->ncmds++];
+    *d = *c;
+    if (!d->argv) {
+        d->argv = arena_alloc(&line_arena, sizeof(char *));
+        d->argv[0] = NULL;
+        d->argv_cap = 1;
+    }
+    return d;
+}
+
+/* ---------- Lexer / parser ---------- */
+/* Single-pass state machine. Operators (| < > >> & && || ;) are recognised only
+   when unquoted, also when glued to words (ls>out), and are tagged while
+   scanning, so the parser never string-compares tokens. $NAME and $? are
+   expanded in plain and double-quoted text, never inside single quotes. Words are
+   copied into line_arena. */
+
+typedef enum {
+    TOK_END,
+    TOK_WORD,
+    TOK_GLOB,       /* word with unquoted wildcards, in escaped form */
+    TOK_PIPE,       /* |  */
+    TOK_IN,         /* <  */
+    TOK_OUT,        /* >  */
+    TOK_APPEND,     /* >> */
+    TOK_AMP,        /* &  */
+    TOK_AND,        /* && */
+    TOK_OR,         /* || */
+    TOK_SEMI        /* ;  */
+} tok_type_t;
+
+typedef enum { LEX_PLAIN, LEX_SQUOTE, LEX_DQUOTE } lex_state_t;
+
+/* Scratch buffer for the word being scanned; grown on demand and kept, so
+   words have no length limit and the common case does not allocate */
+static char *lex_buf;
+static size_t lex_cap;
+
+static void lex_grow(size_t need) {
+    size_t cap = lex_cap ? lex_cap : 256;
+    while (cap < need) cap *= 2;
+    char *grown = realloc(lex_buf, cap);
+    if (!grown) { perror("realloc"); exit(1); }
+    lex_buf = grown;
+    lex_cap = cap;
+}
+
+static bool is_operator_char(char c) {
+    return c == '|' || c == '<' || c == '>' || c == '&' || c == ';';
+}
+
+/* Scan one token at *pp and advance past it. For TOK_WORD, *word_out is
+   the unquoted, expanded text. A word with an unquoted * ? or [ comes
+   back as TOK_GLOB instead, with quoted metacharacters, backslashes and
+   variable values escaped so they stay literal in the pattern. */
+static tok_type_t lex_next(const char **pp, char **word_out) {
+    const char *p = *pp;
+    while (isspace((unsigned char)*p)) p++;
+    if (!*p) { *pp = p; return TOK_END; }
+
+    switch (*p) {
+    case '|':
+        if (p[1] == '|') { *pp = p + 2; return TOK_OR; }
+        *pp = p + 1;
+        return TOK_PIPE;
+    case '<': *pp = p + 1; return TOK_IN;
+    case '&':
+        if (p[1] == '&') { *pp = p + 2; return TOK_AND; }
+        *pp = p + 1;
+        return TOK_AMP;
+    case ';': *pp = p + 1; return TOK_SEMI;
+    case '>':
+        if (p[1] == '>') { *pp = p + 2; return TOK_APPEND; }
+        *pp = p + 1;
+        return TOK_OUT;
+    }
+
+    size_t bi = 0;
+    bool quoted = false, pattern = false, escaped = false;
+    lex_state_t st = LEX_PLAIN;
+#define LEX_PUT(ch) do { if (bi >= lex_cap) lex_grow(bi + 1); lex_buf[bi++] = (ch); } while (0)
+    /* a character that must not act as a wildcard */
+#define LEX_PUT_LITERAL(ch) do { \
+        char lc_ = (ch); \
+        if (lc_ == '*' || lc_ == '?' || lc_ == '[' || lc_ == '\\') { LEX_PUT('\\'); escaped = true; } \
+        LEX_PUT(lc_); \
+    } while (0)
+
+    for (; *p; p++) {
+        char c = *p;
+        if (st == LEX_SQUOTE) {
+            if (c == '\'') st = LEX_PLAIN;
+            else LEX_PUT_LITERAL(c);
+            continue;
+        }
+        if (st == LEX_PLAIN && (isspace((unsigned char)c) || is_operator_char(c))) break;
+
+        if (c == '\\' && p[1]) {
+            LEX_PUT_LITERAL(p[1]);
+            p++;
+        } else if (c == '"') {
+            st = (st == LEX_DQUOTE) ? LEX_PLAIN : LEX_DQUOTE;
+            quoted = true;
+        } else if (c == '\'' && st == LEX_PLAIN) {
+            st = LEX_SQUOTE;
+            quoted = true;
+        } else if (c == '$' && p[1] == '?') {
+            char num[16];
+            int nl = snprintf(num, sizeof(num), "%d", last_status);
+            if (bi + (size_t)nl > lex_cap) lex_grow(bi + (size_t)nl);
+            memcpy(lex_buf + bi, num, (size_t)nl);
+            bi += (size_t)nl;
+            p++;
+        } else if (c == '$' && (isalnum((unsigned char)p[1]) || p[1] == '_')) {
+            const char *name = p + 1;
+            while ((isalnum((unsigned char)p[1]) || p[1] == '_')) p++;
+            char var[128];
+            size_t vlen = (size_t)(p + 1 - name);
+            char *vname = vlen < sizeof(var) ? var : arena_alloc(&line_arena, vlen + 1);
+            memcpy(vname, name, vlen);
+            vname[vlen] = '\0';
+            const char *val = lookup_var(vname);
+            if (val) {
+                size_t vl = strlen(val);
+                if (bi + vl > lex_cap) lex_grow(bi + vl);
+                if (strpbrk(val, "*?[\\")) for (; *val; val++) LEX_PUT_LITERAL(*val);
+                else { memcpy(lex_buf + bi, val, vl); bi += vl; }
+            }
+        } else if (st == LEX_PLAIN && (c == '*' || c == '?' || c == '[')) {
+            pattern = true;
+            LEX_PUT(c);
+        } else if (st == LEX_DQUOTE) {
+            LEX_PUT_LITERAL(c);
+        } else {
+            LEX_PUT(c);
+        }
+    }
+#undef LEX_PUT_LITERAL
+#undef LEX_PUT
+
+    *pp = p;
+    /* an unquoted word that expanded to nothing disappears */
+    if (bi == 0 && !quoted) return lex_next(pp, word_out);
+    *word_out = arena_strndup(&line_arena, lex_buf ? lex_buf : "", bi);
+    if (pattern) return TOK_GLOB;
+    if (escaped) *word_out = glob_unescape(*word_out);
+    return TOK_WORD;
+}
+
+static const char *tok_text(tok_type_t t) {
+    switch (t) {
+    case TOK_PIPE: return "|";
+    case TOK_IN: return "<";
+    case TOK_OUT: return ">";
+    case TOK_APPEND: return ">>";
+    case TOK_AMP: return "&";
+    case TOK_AND: return "&&";
+    case TOK_OR: return "||";
+    case TOK_SEMI: return ";";
+    default: return "";
+    }
+}
+
+/* Flat token list (operators as their literal text), for the '?' preview
+   and alias re-tokenizing. NULL-terminated, lives in line_arena. */
+static char **tokenize(const char *line, int *ntoks_out) {
+    int ti = 0, cap = 16;
+    char **toks = arena_alloc(&line_arena, (size_t)cap * sizeof(char*));
+    const char *p = line;
+    char *word;
+    tok_type_t t;
+    dir_cache_tick();
+    while ((t = lex_next(&p, &word)) != TOK_END) {
+        strvec_t g = { .v = &word, .n = 1 };
+        if (t == TOK_GLOB && glob_expand(word, &g) == 0) {
+            word = glob_unescape(word);
+            g = (strvec_t){ .v = &word, .n = 1 };
+        }
+        for (int k = 0; k < g.n; k++) {
+            if (ti + 2 > cap) {
+                toks = arena_grow(&line_arena, toks, (size_t)cap * sizeof(char*), (size_t)cap * 2 * sizeof(char*));
+                cap *= 2;
+            }
+            toks[ti++] = (t == TOK_WORD || t == TOK_GLOB) ? g.v[k] : (char *)tok_text(t);
+        }
+    }
+    toks[ti] = NULL;
+    *ntoks_out = ti;
+    return toks;
+}
+
+/* Lex and parse one pipeline (a list item) straight into pl. Returns 0,
+   or -1 after printing an error. A redirection with no target is
+   ignored. */
+static int parse_line(const char *line, pipeline_t *pl) {
+    *pl = (pipeline_t){ .ncmds = 0, .background = false };
+    cmd_t cur = { .argc = 0, .infile = NULL, .outfile = NULL, .append = false };
+    tok_type_t pending = TOK_END;     /* redirection waiting for its target */
+    const char *p = line;
+    char *word;
+    tok_type_t t;
+
+    dir_cache_tick();
+    while ((t = lex_next(&p, &word)) != TOK_END) {
+        switch (t) {
+        case TOK_GLOB: {
+            strvec_t g;
+            int n = glob_expand(word, &g);
+            if (pending == TOK_END) {
+                if (n == 0) cmd_push_arg(&cur, glob_unescape(word));
+                for (int k = 0; k < n; k++) cmd_push_arg(&cur, g.v[k]);
+                break;
+            }
+            if (n > 1) {
+                char msg[256];
+                snprintf(msg, sizeof(msg), "%s: ambiguous redirect", glob_unescape(word));
+                print_cyberpunk_error(msg);
+                return -1;
+            }
+            /* a redirection target: one match, or the word as typed */
+            word = n == 1 ? g.v[0] : glob_unescape(word);
+        }
+            /* fall through */
+        case TOK_WORD:
+            if (pending == TOK_IN) cur.infile = word;
+            else if (pending == TOK_OUT || pending == TOK_APPEND) {
+                cur.outfile = word;
+                cur.append = (pending == TOK_APPEND);
+            } else cmd_push_arg(&cur, word);
+            pending = TOK_END;
+            break;
+        case TOK_IN:
+        case TOK_OUT:
+        case TOK_APPEND:
+            pending = t;
+            break;
+        case TOK_PIPE:
+            pipeline_push_cmd(pl, &cur);
+            cur = (cmd_t){ .argc=0, .infile=NULL, .outfile=NULL, .append=false };
+            pending = TOK_END;
+            break;
+        case TOK_AMP:
+            pl->background = true;
+            pending = TOK_END;
+            break;
+        case TOK_AND:
+        case TOK_OR:
+        case TOK_SEMI:          /* parse_list has split them off */
+        case TOK_END:
+            break;
+        }
+    }
+    if (cur.argc > 0 || cur.infile || cur.outfile) pipeline_push_cmd(pl, &cur);
+    return 0;
+}
+
+static void list_push(cmd_list_t *list, char *text, list_op_t op) {
+    if (list->n == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 4;
+        list->items = arena_grow(&line_arena, list->items, sizeof(list_item_t) * (size_t)list->cap,
+                                 sizeof(list_item_t) * (size_t)cap);
+        list->cap = cap;
+    }
+    list->items[list->n++] = (list_item_t){ .text = text, .op = op };
+}
+
+static bool blank_span(const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) if (!isspace((unsigned char)s[i])) return false;
+    return true;
+}
+
+/* Split line into list items at the unquoted ; && || and & (which stays
+   with its pipeline), following lex_next's quoting rules but expanding
+   nothing. Returns 0, or -1 after printing a syntax error. */
+static int parse_list(char *line, cmd_list_t *list) {
+    *list = (cmd_list_t){ .n = 0 };
+    lex_state_t st = LEX_PLAIN;
+    list_op_t op = LIST_SEQ;
+    char *start = line, *p = line;
+    for (; *p; p++) {
+        char c = *p;
+        if (st == LEX_SQUOTE) {
+            if (c == '\'') st = LEX_PLAIN;
+            continue;
+        }
+        if (c == '\\' && p[1]) { p++; continue; }
+        if (c == '"') { st = st == LEX_DQUOTE ? LEX_PLAIN : LEX_DQUOTE; continue; }
+        if (st == LEX_DQUOTE) continue;
+        if (c == '\'') { st = LEX_SQUOTE; continue; }
+
+        list_op_t next = LIST_SEQ;
+        size_t oplen = 1, keep = 0;
+        if (c == '&' && p[1] == '&') { next = LIST_AND; oplen = 2; }
+        else if (c == '|' && p[1] == '|') { next = LIST_OR; oplen = 2; }
+        else if (c == '&') keep = 1;
+        else if (c != ';') continue;
+
+        size_t len = (size_t)(p - start) + keep;
+        if (blank_span(start, len)) {
+            if (op != LIST_SEQ || next != LIST_SEQ) {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "syntax error near '%.*s'", (int)oplen, p);
+                print_cyberpunk_error(msg);
+                return -1;
+            }
+        } else {
+            list_push(list, arena_strndup(&line_arena, start, len), op);
+        }
+        op = next;
+        p += oplen - 1;
+        start = p + 1;
+    }
+    if (list->n == 0) {
+        if (!blank_span(start, (size_t)(p - start))) list_push(list, line, LIST_SEQ);
+        return 0;
+    }
+    if (!blank_span(start, (size_t)(p - start))) {
+        list_push(list, arena_strdup(&line_arena, start), op);
+    } else if (op != LIST_SEQ) {
+        print_cyberpunk_error("syntax error: missing command after && or ||");
+        return -1;
+    }
+    return 0;
+}
+
+/* ---------- Resource accounting ---------- */
+/* Foreground pipelines are reaped with wait4, and the rusage of each
+   stage is kept for the last pipeline: it feeds MYSH_LAST_RUSAGE (and
+   MYSH_LAST_RUSAGE_<n> per stage), the prompt's PROMPT_RUSAGE segment,
+   and the times/timeit builtins. */
+
+static double tv_sec(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double since_sec(const struct timespec *t0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void usage_begin(pipeline_t *pl) {
+    usage_record_t older = prev_usage;
+    prev_usage = last_usage;
+    last_usage = older;     /* reuse its arrays */
+    last_usage.published = prev_usage.published;
+    last_usage.running = true;
+    memset(&last_usage.total, 0, sizeof(last_usage.total));
+    if (pl->ncmds > last_usage.cap) {
+        int cap = pl->ncmds;
+        usage_t *st = realloc(last_usage.stages, sizeof(usage_t) * (size_t)cap);
+        char (*nm)[32] = st ? realloc(last_usage.names, sizeof(*nm) * (size_t)cap) : NULL;
+        if (!st || !nm) { perror("realloc"); exit(1); }
+        last_usage.stages = st;
+        last_usage.names = nm;
+        last_usage.cap = cap;
+    }
+    last_usage.nstages = pl->ncmds;
+    for (int i = 0; i < pl->ncmds; i++) {
+        memset(&last_usage.stages[i], 0, sizeof(usage_t));
+        snprintf(last_usage.names[i], sizeof(last_usage.names[i]), "%s",
+                 pl->cmds[i].argc > 0 ? pl->cmds[i].argv[0] : "");
+    }
+    last_usage.valid = true;
+    clock_gettime(CLOCK_MONOTONIC, &last_usage.started);
+}
+
+static void usage_add(usage_t *u, const struct rusage *ru) {
+    u->user += tv_sec(ru->ru_utime);
+    u->sys += tv_sec(ru->ru_stime);
+    if (ru->ru_maxrss > u->maxrss) u->maxrss = ru->ru_maxrss;
+    u->nvcsw += ru->ru_nvcsw;
+    u->nivcsw += ru->ru_nivcsw;
+}
+
+static void usage_stage_done(int stage, const struct rusage *ru) {
+    if (stage < 0 || stage >= last_usage.nstages) return;
+    usage_t *u = &last_usage.stages[stage];
+    u->wall = since_sec(&last_usage.started);
+    usage_add(u, ru);
+    usage_add(&last_usage.total, ru);
+}
+
+static void usage_format(char *buf, size_t sz, const usage_t *u) {
+    snprintf(buf, sz, "wall=%.3f user=%.3f sys=%.3f maxrss=%ld vcsw=%ld ivcsw=%ld",
+             u->wall, u->user, u->sys, u->maxrss, u->nvcsw, u->nivcsw);
+}
+
+static void usage_end(void) {
+    last_usage.running = false;
+    last_usage.total.wall = since_sec(&last_usage.started);
+
+    char buf[256], name[64];
+    usage_format(buf, sizeof(buf), &last_usage.total);
+    set_transient_var("MYSH_LAST_RUSAGE", buf);
+    for (int i = 0; i < last_usage.nstages; i++) {
+        usage_format(buf, sizeof(buf), &last_usage.stages[i]);
+        snprintf(name, sizeof(name), "MYSH_LAST_RUSAGE_%d", i + 1);
+        set_transient_var(name, buf);
+    }
+    for (int i = last_usage.nstages; i < last_usage.published; i++) {
+        snprintf(name, sizeof(name), "MYSH_LAST_RUSAGE_%d", i + 1);
+        unset_shell_var(name);
+    }
+    last_usage.published = last_usage.nstages;
+}
+
+/* ---------- Builtins ---------- */
+
+/* cd with tilde expansion */
+static int builtin_cd(int argc, char **argv) {
+    const char *path;
+    if (argc < 2) path = getenv("HOME");
+    else path = argv[1];
+
+    char *expanded = expand_tilde(path);
+    if (chdir(expanded) != 0) {
+        print_cyberpunk_error("cd: Directory not found");
+        free(expanded);
+        return 1;
+    }
+    free(expanded);
+    prompt_refresh_cwd();
+    return 0;
+}
+
+/* Save state and leave the shell; the goodbye box is interactive-only */
+static void shell_exit(int code) {
+    save_history();
+    save_persistent_data();
+
+    if (interactive) {
+        out_printf("\n");
+        print_header_border("🛑 SESSION TERMINATED 🛑");
+        out_printf(CLR_NEON_GREEN "         Neural interface disconnecting • Goodbye!\n" CLR_RESET);
+        out_printf("\n");
+    }
+
+    trace_stop();
+    out_flush();
+    exit(code);
+}
+
+/* exit [n] (saves state before quitting) */
+static int builtin_exit(int argc, char **argv) {
+    shell_exit(argc > 1 ? atoi(argv[1]) : 0);
+    return 0;
+}
+
+static int builtin_mkdir(int argc, char **argv) {
+    if (argc < 2) {
+        print_cyberpunk_error("mkdir: missing operand");
+        return 1;
+    }
+    for (int i=1;i<argc;i++) {
+        if (mkdir(argv[i], 0755) != 0) {
+            print_cyberpunk_error("mkdir: Failed to create directory");
+        } else {
+            out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "CREATED" CLR_DARK_GRAY "] " CLR_RESET "Directory: %s\n", argv[i]);
+        }
+    }
+    return 0;
+}
+
+static int builtin_touch(int argc, char **argv) {
+    if (argc < 2) {
+        print_cyberpunk_error("touch: missing file operand");
+        return 1;
+    }
+    for (int i=1;i<argc;i++) {
+        int fd = open(argv[i], O_CREAT|O_WRONLY, 0644);
+        if (fd < 0) {
+            print_cyberpunk_error("touch: Failed to create file");
+        } else {
+            close(fd);
+            out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "CREATED" CLR_DARK_GRAY "] " CLR_RESET "File: %s\n", argv[i]);
+        }
+    }
+    return 0;
+}
+
+static int builtin_clear(int argc, char **argv) {
+    (void)argc; (void)argv;
+    out_printf("\033[H\033[2J");
+    out_flush();
+    return 0;
+}
+
+static int builtin_help(int argc, char **argv) {
+    (void)argc; (void)argv;
+
+    out_printf("\n");
+    print_header_border("🎮 CYBER-COMMANDS 🎮");
+    out_printf("\n");
+
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_GREEN "                         CORE COMMANDS                          " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+
+    print_content_line("cd [dir]", "Navigate directories (cd ~ for home)");
     print_content_line("exit", "Terminate cyber-session");
     print_content_line("mkdir/touch", "Create directories/files");
     print_content_line("clear", "Clear terminal display");
     print_content_line("history", "View command history");
+    print_content_line("histsearch [-ipt]", "Search history, most relevant first");
     print_content_line("jobs/fg/bg", "Manage background processes");
 
     print_section_border("CUSTOMIZATION");
     print_content_line("alias/unalias", "Create/remove command shortcuts");
     print_content_line("set/unset", "Manage shell variables");
     print_content_line("vars/aliases", "List all variables and aliases");
+    print_content_line("hash [-r|-l]", "Show/reset cached command paths");
+    print_content_line("parallel -j N ...", "cmd ::: items - run N at a time");
+    print_content_line("times", "Resource usage of the last pipeline");
+    print_content_line("timeit [-n N] ...", "Repeat a pipeline, report mean/p50/p99");
+    print_content_line("trace on|off", "Write phase timings as Chrome trace JSON");
+    print_content_line("coproc [-n N] NAME", "cmd - warm workers; send/feed/stop NAME");
+    print_content_line("cache [--ttl S] ...", "Replay a command's output while fresh");
 
     print_section_border("FEATURES");
     print_content_line("TAB completion", "Auto-complete filenames");
@@ -922,22 +3377,24 @@ static int builtin_help(int argc, char **argv) {
 
     print_bottom_border();
 
-    printf("\n");
-    printf(CLR_NEON_PURPLE "💡 " CLR_NEON_CYAN "Pro tip: Add ? to any command to see tokenized preview\n" CLR_RESET);
-    printf("\n");
+    out_printf("\n");
+    out_printf(CLR_NEON_PURPLE "💡 " CLR_NEON_CYAN "Pro tip: Add ? to any command to see tokenized preview\n" CLR_RESET);
+    out_printf("\n");
 
     return 0;
 }
 
 static int builtin_history(int argc, char **argv) {
     (void)argc; (void)argv;
+    history_ensure();
 
-    printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        COMMAND HISTORY                         " CLR_DARK_GRAY "│\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        COMMAND HISTORY                         " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
 
     for (int i=0;i<history_count;i++) {
-        printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%4d" CLR_DARK_GRAY " │ " CLR_LIGHT_GRAY "%-55s" CLR_DARK_GRAY " │\n", i+1, history[i]);
+        const hist_entry_t *e = history_at(i);
+        out_printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%4d" CLR_DARK_GRAY " │ " CLR_LIGHT_GRAY "%-55.*s" CLR_DARK_GRAY " │\n", i+1, (int)e->len, e->text);
     }
 
     print_bottom_border();
@@ -946,34 +3403,64 @@ static int builtin_history(int argc, char **argv) {
 }
 
 static int builtin_histsearch(int argc, char **argv) {
-    if (argc < 2) {
-        print_cyberpunk_error("histsearch <term>");
+    int flags = 0;
+    bool timing = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'i') flags |= HS_ICASE;
+            else if (*f == 'p') flags |= HS_PREFIX;
+            else if (*f == 't') timing = true;
+            else { i = argc; break; }
+        }
+    }
+    if (i >= argc) {
+        print_cyberpunk_error("histsearch [-i] [-p] [-t] <term>");
         return 1;
     }
 
-    printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        SEARCH RESULTS                          " CLR_DARK_GRAY "│\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    /* the rest of the line is the term, so multi-word searches work unquoted */
+    char term[1024] = "";
+    for (; i < argc; i++) {
+        if (term[0]) strncat(term, " ", sizeof(term) - strlen(term) - 1);
+        strncat(term, argv[i], sizeof(term) - strlen(term) - 1);
+    }
 
-    int found = 0;
-    for (int i=0;i<history_count;i++) {
-        if (strstr(history[i], argv[1])) {
-            printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%4d" CLR_DARK_GRAY " │ " CLR_LIGHT_GRAY "%-55s" CLR_DARK_GRAY " │\n", i+1, history[i]);
-            found = 1;
-        }
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    hist_match_t *m;
+    long visited;
+    int n = history_search(term, flags, &m, &visited);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        SEARCH RESULTS                          " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+
+    for (int k = 0; k < n; k++) {
+        const hist_entry_t *e = history_at(m[k].index);
+        out_printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%4d" CLR_DARK_GRAY " │ " CLR_LIGHT_GRAY "%-55.*s" CLR_DARK_GRAY " │\n", m[k].index+1, (int)e->len, e->text);
     }
 
-    if (!found) {
-        printf(CLR_DARK_GRAY "│ " CLR_NEON_PINK " No matches found for: %-40s " CLR_DARK_GRAY "│\n", argv[1]);
+    if (n == 0) {
+        out_printf(CLR_DARK_GRAY "│ " CLR_NEON_PINK " No matches found for: %-40s " CLR_DARK_GRAY "│\n", term);
     }
 
     print_bottom_border();
 
+    if (timing) {
+        double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+        out_printf(CLR_DARK_GRAY "[" CLR_NEON_CYAN "TIME" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY
+               "%d matches, %ld of %d entries scanned, %.3f ms\n" CLR_RESET, n, visited, history_count, ms);
+    }
+    free(m);
+
     return 0;
 }
 
 static int builtin_jobs(int argc, char **argv) {
     (void)argc; (void)argv;
+    reap_children();
     print_jobs();
     remove_done_jobs();
     return 0;
@@ -990,15 +3477,43 @@ static int builtin_fg(int argc, char **argv) {
         print_cyberpunk_error("fg: no such job");
         return 1;
     }
-    j->state = JOB_RUNNING;
-    tcsetpgrp(STDIN_FILENO, j->pgid);
+    set_job_state(j, JOB_RUNNING);
+    if (interactive) tcsetpgrp(STDIN_FILENO, j->pgid);
     fg_pgid = j->pgid;
     if (kill(-j->pgid, SIGCONT) < 0) perror("kill(SIGCONT)");
-    int status;
-    waitpid(-j->pgid, &status, WUNTRACED);
-    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    char *usage_argv[] = { j->cmdline, NULL };
+    cmd_t usage_cmd = { .argv = usage_argv, .argc = 1 };
+    pipeline_t usage_pl = { .cmds = &usage_cmd, .ncmds = 1 };
+    usage_begin(&usage_pl);
+    int status = 0;
+    struct rusage ru;
+    while (j->nprocs > 0) {
+        pid_t w = wait4(-j->pgid, &status, WUNTRACED, &ru);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (WIFSTOPPED(status)) {
+            set_job_state(j, JOB_STOPPED);
+            break;
+        }
+        usage_stage_done(0, &ru);
+        if (pid_job_take(w) == j) job_member_exited(j, w, status);
+    }
+    usage_end();
+    if (interactive) tcsetpgrp(STDIN_FILENO, shell_pgid);
     fg_pgid = 0;
-    return 0;
+
+    /* $? and PIPESTATUS as if the job had run in the foreground */
+    int rc = j->status;
+    if (j->state == JOB_STOPPED) {
+        rc = 128 + WSTOPSIG(status);
+        for (int i = 0; i < j->nstages; i++)
+            if (j->stage_pids[i] > 0) j->stage_status[i] = rc;
+    }
+    publish_pipestatus(j->stage_status, j->nstages);
+    builtin_pipestatus = true;
+    return rc;
 }
 
 static int builtin_bg(int argc, char **argv) {
@@ -1012,20 +3527,275 @@ static int builtin_bg(int argc, char **argv) {
         print_cyberpunk_error("bg: no such job");
         return 1;
     }
-    j->state = JOB_RUNNING;
+    set_job_state(j, JOB_RUNNING);
     if (kill(-j->pgid, SIGCONT) < 0) perror("kill(SIGCONT)");
     return 0;
 }
 
+static int execute_pipeline(pipeline_t *pl, char *rawline);
+static int execute_list(const cmd_list_t *list, bool quiet);
+
+static double elapsed_sec(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* word with every {} replaced by item (arena), or word itself */
+static char *subst_placeholder(char *word, const char *item) {
+    if (!strstr(word, "{}")) return word;
+    size_t ilen = strlen(item), n = 0;
+    for (const char *p = word; (p = strstr(p, "{}")); p += 2) n++;
+    char *out = arena_alloc(&line_arena, strlen(word) + n * ilen + 1);
+    char *o = out;
+    for (const char *p = word; *p; ) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(o, item, ilen);
+            o += ilen;
+            p += 2;
+        } else {
+            *o++ = *p++;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+/* parallel [-j N] cmd [args] ::: item...
+   Runs cmd once per item (substituted for each {}, or appended),
+   keeping N quiet background jobs in flight (default: online CPUs) and
+   reporting each one's exit status and wall time as it finishes. */
+static int builtin_parallel(int argc, char **argv) {
+    long nslots = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+        nslots = atol(argv[i+1]);
+        i += 2;
+    } else if (i < argc && strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+        nslots = atol(argv[i] + 2);
+        i++;
+    }
+    int cmd_start = i, sep = -1;
+    for (; i < argc; i++) if (strcmp(argv[i], ":::") == 0) { sep = i; break; }
+    if (sep < 0 || sep == cmd_start || nslots < 1) {
+        print_cyberpunk_error("parallel [-j N] cmd [args] ::: item...");
+        return 1;
+    }
+    int nitems = argc - sep - 1;
+    bool has_placeholder = false;
+    for (int k = cmd_start; k < sep; k++) if (strstr(argv[k], "{}")) has_placeholder = true;
+
+    job_t **slots = calloc((size_t)nslots, sizeof(job_t *));
+    int *slot_item = calloc((size_t)nslots, sizeof(int));
+    if (!slots || !slot_item) { perror("calloc"); exit(1); }
+
+    struct timespec t0, now;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int next = 0, finished = 0, failed = 0, inflight = 0;
+    got_sigint = 0;
+
+    while (finished < nitems) {
+        /* fill free slots */
+        for (int s = 0; s < nslots && next < nitems && !got_sigint; s++) {
+            if (slots[s]) continue;
+            const char *item = argv[sep + 1 + next];
+            pipeline_t pl = { .background = true, .quiet = true };
+            cmd_t *c = pipeline_push_cmd(&pl, &(cmd_t){ .argc = 0 });
+            for (int k = cmd_start; k < sep; k++) cmd_push_arg(c, subst_placeholder(argv[k], item));
+            if (!has_placeholder) cmd_push_arg(c, (char *)item);
+
+            last_bg_job = NULL;
+            execute_pipeline(&pl, sb_join(c->argv, 0, c->argc));
+            if (!last_bg_job) {
+                failed++;
+                finished++;
+            } else {
+                slots[s] = last_bg_job;
+                slot_item[s] = next;
+                inflight++;
+            }
+            next++;
+        }
+        if (got_sigint) {
+            /* stop launching; take the in-flight jobs down with us */
+            for (int s = 0; s < nslots; s++) if (slots[s]) kill(-slots[s]->pgid, SIGTERM);
+            finished += nitems - next;
+            failed += nitems - next;
+            next = nitems;
+        }
+        if (inflight == 0) continue;
+
+        /* sleep until a child changes state; the timeout is a backstop
+           for a SIGCHLD that never reaches sigchld_fd */
+        struct pollfd pfd = { .fd = sigchld_fd, .events = POLLIN };
+        poll(&pfd, 1, 100);
+        reap_children();
+
+        for (int s = 0; s < nslots; s++) {
+            job_t *j = slots[s];
+            if (!j || j->state != JOB_DONE) continue;
+            if (j->status != 0) failed++;
+            out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "PARALLEL" CLR_DARK_GRAY "] "
+                   "%s%3d" CLR_DARK_GRAY " │ " CLR_LIGHT_GRAY "%7.3fs" CLR_DARK_GRAY " │ "
+                   CLR_LIGHT_GRAY "#%d %s\n" CLR_RESET,
+                   j->status == 0 ? CLR_NEON_GREEN : CLR_NEON_PINK, j->status,
+                   elapsed_sec(&j->started, &j->finished), slot_item[s] + 1, j->cmdline);
+            out_end();
+            slots[s] = NULL;
+            inflight--;
+            finished++;
+        }
+        remove_done_jobs();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "PARALLEL" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY
+           "%d jobs, %d failed, %ld slots, %.3fs wall\n" CLR_RESET,
+           nitems, failed, nslots, elapsed_sec(&t0, &now));
+    free(slots);
+    free(slot_item);
+    return failed ? 1 : 0;
+}
+
+static void print_usage_row(const char *label, const usage_t *u) {
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%.3fs wall %.3fs cpu %ldK rss", u->wall, u->user + u->sys, u->maxrss);
+    print_content_line(label, detail);
+}
+
+/* Last foreground pipeline per stage, then shell and children totals */
+static int builtin_times(int argc, char **argv) {
+    (void)argc; (void)argv;
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                         RESOURCE USAGE                          " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+
+    const usage_record_t *u = last_usage.running ? &prev_usage : &last_usage;
+    if (u->valid) {
+        for (int i = 0; i < u->nstages; i++) print_usage_row(u->names[i], &u->stages[i]);
+        print_usage_row("pipeline", &u->total);
+        char ctx[64];
+        snprintf(ctx, sizeof(ctx), "%ld voluntary, %ld involuntary", u->total.nvcsw, u->total.nivcsw);
+        print_content_line("context switches", ctx);
+    }
+
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    char line[64];
+    snprintf(line, sizeof(line), "%.3fs user %.3fs sys", tv_sec(self.ru_utime), tv_sec(self.ru_stime));
+    print_content_line("shell", line);
+    snprintf(line, sizeof(line), "%.3fs user %.3fs sys", tv_sec(children.ru_utime), tv_sec(children.ru_stime));
+    print_content_line("all children", line);
+
+    print_bottom_border();
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* timeit [-n N] pipeline...: run it N times (default 10) and report
+   wall-time mean/p50/p99 and mean CPU. Quote the pipeline to time
+   more than one stage or a list, e.g. timeit -n 5 'ls | wc -l'. */
+static int builtin_timeit(int argc, char **argv) {
+    long runs = 10;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+        runs = atol(argv[i+1]);
+        i += 2;
+    }
+    if (i >= argc || runs < 1) {
+        print_cyberpunk_error("timeit [-n N] pipeline...");
+        return 1;
+    }
+    char *line = sb_join(argv, i, argc);
+
+    double *walls = malloc((size_t)runs * sizeof(double));
+    if (!walls) { perror("malloc"); exit(1); }
+    double wall_sum = 0, cpu_sum = 0;
+    long maxrss = 0;
+    int rc = 0;
+    got_sigint = 0;
+    long done = 0;
+    cmd_list_t list;
+    if (parse_list(line, &list) < 0) { free(walls); return 2; }
+    for (; done < runs && !got_sigint; done++) {
+        last_usage.valid = false;
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        rc = execute_list(&list, true);
+        walls[done] = since_sec(&t0);
+        wall_sum += walls[done];
+        if (last_usage.valid) {
+            cpu_sum += last_usage.total.user + last_usage.total.sys;
+            if (last_usage.total.maxrss > maxrss) maxrss = last_usage.total.maxrss;
+        }
+    }
+    if (done == 0) { free(walls); return rc ? rc : 1; }
+
+    qsort(walls, (size_t)done, sizeof(double), cmp_double);
+    /* nearest-rank percentiles */
+    double p50 = walls[(done * 50 + 99) / 100 - 1];
+    double p99 = walls[(done * 99 + 99) / 100 - 1];
+
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                         TIMEIT RESULTS                          " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    char v[64];
+    snprintf(v, sizeof(v), "%.42s", line);
+    print_content_line("pipeline", v);
+    snprintf(v, sizeof(v), "%ld", done);
+    print_content_line("runs", v);
+    snprintf(v, sizeof(v), "%.3f ms", wall_sum / done * 1e3);
+    print_content_line("mean", v);
+    snprintf(v, sizeof(v), "%.3f ms", p50 * 1e3);
+    print_content_line("p50", v);
+    snprintf(v, sizeof(v), "%.3f ms", p99 * 1e3);
+    print_content_line("p99", v);
+    snprintf(v, sizeof(v), "%.3f ms .. %.3f ms", walls[0] * 1e3, walls[done-1] * 1e3);
+    print_content_line("min .. max", v);
+    snprintf(v, sizeof(v), "%.3f ms", cpu_sum / done * 1e3);
+    print_content_line("mean cpu", v);
+    snprintf(v, sizeof(v), "%ldK", maxrss);
+    print_content_line("max rss", v);
+    print_bottom_border();
+
+    free(walls);
+    return rc;
+}
+
+/* trace [on [file] | off]: Chrome trace-event spans of the shell's phases */
+static int builtin_trace(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "on") == 0) {
+        const char *path = argc >= 3 ? argv[2] : lookup_var("MYSH_TRACE");
+        if (!path || !*path) path = "mysh-trace.json";
+        if (!trace_start(path)) {
+            char msg[512];
+            snprintf(msg, sizeof(msg), "trace: %s: %s", path, strerror(errno));
+            print_cyberpunk_error(msg);
+            return 1;
+        }
+    } else if (argc >= 2 && strcmp(argv[1], "off") == 0) {
+        trace_stop();
+    } else if (argc >= 2) {
+        print_cyberpunk_error("trace [on [file] | off]");
+        return 1;
+    }
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_CYAN "TRACE" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s%s\n" CLR_RESET,
+           trace_fd >= 0 ? "writing to " : "off", trace_fd >= 0 ? trace_path : "");
+    return 0;
+}
+
 static int builtin_alias(int argc, char **argv) {
     if (argc == 1) {
-        printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-        printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                       COMMAND ALIASES                         " CLR_DARK_GRAY "│\n" CLR_RESET);
-        printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+        out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+        out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                       COMMAND ALIASES                         " CLR_DARK_GRAY "│\n" CLR_RESET);
+        out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
 
         for (int i = 0; i < alias_count; i++) {
-            printf(CLR_DARK_GRAY "│ " CLR_NEON_GREEN "%-20s" CLR_DARK_GRAY " → " CLR_LIGHT_GRAY "%-40s" CLR_DARK_GRAY " │\n",
-                   aliases[i].name, aliases[i].value);
+            out_printf(CLR_DARK_GRAY "│ " CLR_NEON_GREEN "%-20s" CLR_DARK_GRAY " → " CLR_LIGHT_GRAY "%-40s" CLR_DARK_GRAY " │\n",
+                   aliases[i]->name, aliases[i]->value);
         }
 
         print_bottom_border();
@@ -1033,13 +3803,9 @@ static int builtin_alias(int argc, char **argv) {
     }
 
     if (argc >= 3) {
-        char value[4096] = {0};
-        for (int i = 2; i < argc; i++) {
-            if (i > 2) strncat(value, " ", sizeof(value) - strlen(value) - 1);
-            strncat(value, argv[i], sizeof(value) - strlen(value) - 1);
-        }
+        char *value = sb_join(argv, 2, argc);
         add_alias(argv[1], value);
-        printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "ALIAS CREATED" CLR_DARK_GRAY "] " CLR_NEON_GREEN "%s" CLR_DARK_GRAY " → " CLR_LIGHT_GRAY "%s\n" CLR_RESET,
+        out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "ALIAS CREATED" CLR_DARK_GRAY "] " CLR_NEON_GREEN "%s" CLR_DARK_GRAY " → " CLR_LIGHT_GRAY "%s\n" CLR_RESET,
                argv[1], value);
         return 0;
     }
@@ -1054,17 +3820,9 @@ static int builtin_unalias(int argc, char **argv) {
         return 1;
     }
 
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, argv[1]) == 0) {
-            free(aliases[i].name);
-            free(aliases[i].value);
-            for (int j = i; j < alias_count - 1; j++) {
-                aliases[j] = aliases[j + 1];
-            }
-            alias_count--;
-            printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "ALIAS REMOVED" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s\n" CLR_RESET, argv[1]);
-            return 0;
-        }
+    if (remove_alias(argv[1])) {
+        out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "ALIAS REMOVED" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s\n" CLR_RESET, argv[1]);
+        return 0;
     }
 
     print_cyberpunk_error("unalias: not found");
@@ -1072,13 +3830,22 @@ static int builtin_unalias(int argc, char **argv) {
 }
 
 static int builtin_set(int argc, char **argv) {
-    if (argc < 3) {
-        print_cyberpunk_error("set: usage: set <name> <value>");
+    char *name = argc > 1 ? argv[1] : NULL, *value = argc > 2 ? argv[2] : NULL;
+    char *eq = name ? strchr(name, '=') : NULL;
+    if (argc == 2 && eq && eq != name) {
+        /* set NAME=VALUE */
+        name = arena_strndup(&line_arena, argv[1], (size_t)(eq - argv[1]));
+        value = eq + 1;
+    }
+    if (!name || !value) {
+        print_cyberpunk_error("set: usage: set <name> <value> | set <name>=<value>");
         return 1;
     }
 
-    set_shell_var(argv[1], argv[2]);
-    printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "VARIABLE SET" CLR_DARK_GRAY "] " CLR_NEON_GREEN "%s" CLR_DARK_GRAY " = " CLR_LIGHT_GRAY "%s\n" CLR_RESET, argv[1], argv[2]);
+    set_shell_var(name, value);
+    if (strcmp(name, "PATH") == 0) hash_clear();
+    if (strcmp(name, "NO_COLOR") == 0) { out_setup(); prompt_cache.dirty = true; }
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "VARIABLE SET" CLR_DARK_GRAY "] " CLR_NEON_GREEN "%s" CLR_DARK_GRAY " = " CLR_LIGHT_GRAY "%s\n" CLR_RESET, name, value);
     return 0;
 }
 
@@ -1088,289 +3855,2268 @@ static int builtin_unset(int argc, char **argv) {
         return 1;
     }
 
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(shell_vars[i].name, argv[1]) == 0) {
-            free(shell_vars[i].name);
-            free(shell_vars[i].value);
-            for (int j = i; j < var_count - 1; j++) {
-                shell_vars[j] = shell_vars[j + 1];
-            }
-            var_count--;
-            printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "VARIABLE REMOVED" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s\n" CLR_RESET, argv[1]);
-            return 0;
+    if (unset_shell_var(argv[1])) {
+        if (strcmp(argv[1], "PATH") == 0) hash_clear();
+        if (strcmp(argv[1], "NO_COLOR") == 0) { out_setup(); prompt_cache.dirty = true; }
+        out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "VARIABLE REMOVED" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s\n" CLR_RESET, argv[1]);
+        return 0;
+    }
+
+    print_cyberpunk_error("unset: not found");
+    return 1;
+}
+
+static int builtin_vars(int argc, char **argv) {
+    (void)argc; (void)argv;
+
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                       SHELL VARIABLES                         " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+
+    for (int i = 0; i < var_count; i++) {
+        out_printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%-20s" CLR_DARK_GRAY " = " CLR_LIGHT_GRAY "%-40s" CLR_DARK_GRAY " │\n",
+               shell_vars[i]->name, shell_vars[i]->value);
+    }
+
+    print_bottom_border();
+
+    return 0;
+}
+
+static int builtin_aliases(int argc, char **argv) {
+    (void)argc;
+    return builtin_alias(1, argv);
+}
+
+/* hash [-r] [-l] [name...] */
+static int builtin_hash(int argc, char **argv) {
+    bool list = (argc == 1);
+    int rc = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            hash_clear();
+            out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "HASH CLEARED" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "Command path table reset\n" CLR_RESET);
+        } else if (strcmp(argv[i], "-l") == 0) {
+            list = true;
+        } else if (is_builtin(argv[i])) {
+            continue;
+        } else if (!hash_lookup(argv[i])) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "hash: %s: not found", argv[i]);
+            print_cyberpunk_error(msg);
+            rc = 1;
+        }
+    }
+    if (!list) return rc;
+
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        HASHED COMMANDS                          " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+
+    for (size_t i = 0; i < cmd_hash.cap; i++) {
+        if (!cmd_hash.slots[i].key) continue;
+        cmd_hash_entry_t *e = cmd_hash.slots[i].value;
+        out_printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%4d" CLR_DARK_GRAY " │ " CLR_NEON_GREEN "%-16s" CLR_DARK_GRAY " → " CLR_LIGHT_GRAY "%-37s" CLR_DARK_GRAY " │\n",
+               e->hits, e->name, e->path);
+    }
+
+    print_bottom_border();
+    return rc;
+}
+
+/* Builtin dispatch helper */
+static const char *builtin_names[] = {
+    "cd","exit","mkdir","touch","clear","help","history","histsearch",
+    "jobs","fg","bg","alias","unalias","set","unset","vars","aliases","hash","parallel","times","timeit","trace","coproc","cache", NULL
+};
+
+static bool is_builtin(const char *cmd) {
+    for (int i=0; builtin_names[i]; i++) if (strcmp(cmd, builtin_names[i])==0) return true;
+    return false;
+}
+
+static int run_builtin(int argc, char **argv) {
+    if (argc<=0) return 0;
+    if (strcmp(argv[0],"cd")==0) return builtin_cd(argc,argv);
+    if (strcmp(argv[0],"exit")==0) return builtin_exit(argc,argv);
+    if (strcmp(argv[0],"mkdir")==0) return builtin_mkdir(argc,argv);
+    if (strcmp(argv[0],"touch")==0) return builtin_touch(argc,argv);
+    if (strcmp(argv[0],"clear")==0) return builtin_clear(argc,argv);
+    if (strcmp(argv[0],"help")==0) return builtin_help(argc,argv);
+    if (strcmp(argv[0],"history")==0) return builtin_history(argc,argv);
+    if (strcmp(argv[0],"histsearch")==0) return builtin_histsearch(argc,argv);
+    if (strcmp(argv[0],"jobs")==0) return builtin_jobs(argc,argv);
+    if (strcmp(argv[0],"fg")==0) return builtin_fg(argc,argv);
+    if (strcmp(argv[0],"bg")==0) return builtin_bg(argc,argv);
+    if (strcmp(argv[0],"alias")==0) return builtin_alias(argc,argv);
+    if (strcmp(argv[0],"unalias")==0) return builtin_unalias(argc,argv);
+    if (strcmp(argv[0],"set")==0) return builtin_set(argc,argv);
+    if (strcmp(argv[0],"unset")==0) return builtin_unset(argc,argv);
+    if (strcmp(argv[0],"vars")==0) return builtin_vars(argc,argv);
+    if (strcmp(argv[0],"aliases")==0) return builtin_aliases(argc,argv);
+    if (strcmp(argv[0],"hash")==0) return builtin_hash(argc,argv);
+    if (strcmp(argv[0],"parallel")==0) return builtin_parallel(argc,argv);
+    if (strcmp(argv[0],"times")==0) return builtin_times(argc,argv);
+    if (strcmp(argv[0],"timeit")==0) return builtin_timeit(argc,argv);
+    if (strcmp(argv[0],"trace")==0) return builtin_trace(argc,argv);
+    if (strcmp(argv[0],"coproc")==0) return builtin_coproc(argc,argv);
+    if (strcmp(argv[0],"cache")==0) return builtin_cache(argc,argv);
+    return 127;
+}
+
+/* ---------- Execution helpers ---------- */
+
+/* Setup IO redirection for a child process. On failure the child exits. */
+static void redirect_io(const char *infile, const char *outfile, bool append) {
+    if (infile) {
+        int fd = open(infile, O_RDONLY);
+        if (fd < 0) { perror("open infile"); _exit(1); }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (outfile) {
+        int flags = O_WRONLY | O_CREAT | (append? O_APPEND : O_TRUNC);
+        int fd = open(outfile, flags, 0644);
+        if (fd < 0) { perror("open outfile"); _exit(1); }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+}
+
+/* Spawn backends. posix_spawn (vfork-style clone in glibc) is the default
+   for external commands, so fork latency does not grow with the shell's
+   RSS; fork is kept for builtins that must run inside a pipeline and can
+   be forced with MYSH_SPAWN=fork for comparison. */
+
+static bool use_fork_backend(void) {
+    const char *b = lookup_var("MYSH_SPAWN");
+    return b && strcmp(b, "fork") == 0;
+}
+
+/* Inter-stage pipes are created O_CLOEXEC: dup2 onto stdin/stdout clears
+   the flag on the copy, and exec drops every other pipe end, so children
+   need no close loop over the pipeline's fds. PIPE_BUF_SIZE (bytes, or
+   with a K/M suffix) resizes each pipe with F_SETPIPE_SZ; a larger buffer
+   lets a fast producer run ahead of its consumer instead of switching
+   every 64 KiB. */
+
+static long parse_size(const char *s) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (errno || end == s || v <= 0) return -1;
+    long mul = 1;
+    if (*end == 'k' || *end == 'K') { mul = 1024; end++; }
+    else if (*end == 'm' || *end == 'M') { mul = 1024L*1024; end++; }
+    if (*end == 'b' || *end == 'B') end++;
+    if (*end || v > LONG_MAX / mul) return -1;
+    return v * mul;
+}
+
+static long pipe_buf_size(void) {
+    static char *warned;
+    const char *v = lookup_var("PIPE_BUF_SIZE");
+    if (!v || !*v) return 0;
+    long size = parse_size(v);
+    if (size < 0 && (!warned || strcmp(warned, v) != 0)) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "PIPE_BUF_SIZE: invalid size '%s'", v);
+        print_cyberpunk_error(msg);
+        free(warned);
+        warned = strdup_safe(v);
+    }
+    return size > 0 ? size : 0;
+}
+
+static bool open_stage_pipe(int fds[2], long size) {
+    if (pipe2(fds, O_CLOEXEC) < 0) return false;
+    if (size > 0 && size <= INT_MAX && fcntl(fds[1], F_SETPIPE_SZ, (int)size) < 0) {
+        /* above /proc/sys/fs/pipe-max-size without CAP_SYS_RESOURCE: take
+           the largest size an unprivileged process may set */
+        static int max_size = -1;
+        if (max_size < 0) {
+            max_size = 0;
+            FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+            if (f) { if (fscanf(f, "%d", &max_size) != 1) max_size = 0; fclose(f); }
+        }
+        if (max_size > 0 && size > max_size) fcntl(fds[1], F_SETPIPE_SZ, max_size);
+    }
+    return true;
+}
+
+static pid_t spawn_stage_fork(cmd_t *c, const char *exec_path, int in_fd, int out_fd,
+                              const int *pipefds, int npipefds, pid_t pgid, bool foreground) {
+    pid_t p = fork();
+    if (p != 0) return p;
+
+    trace_fd = -1;      /* the parent owns the trace file and its buffer */
+    setpgid(0, pgid);
+    if (foreground && interactive) tcsetpgrp(STDIN_FILENO, pgid ? pgid : getpid());
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+
+    redirect_io(c->infile, c->outfile, c->append);
+
+    if (is_builtin(c->argv[0])) {
+        /* no exec here, so O_CLOEXEC does not drop the other pipe ends */
+        for (int j=0;j<npipefds;j++) close(pipefds[j]);
+        block_sigchld();    /* parallel and coproc stop wait on sigchld_fd */
+        out_setup();
+        int rc = run_builtin(c->argc, c->argv);
+        out_flush();
+        /* not exit(): flushing the inherited script FILE at exit would
+           rewind the offset we share with the parent's reader */
+        _exit(rc);
+    }
+    if (exec_path) {
+        execv(exec_path, c->argv);
+        /* stale hash entry: fall back to a fresh PATH search */
+        if (errno == ENOENT && exec_path != c->argv[0]) execvp(c->argv[0], c->argv);
+    }
+    fprintf(stderr, "mysh: command not found: %s\n", c->argv[0]);
+    _exit(127);
+}
+
+/* posix_spawn backend: the dup2/close/open work of redirect_io becomes file
+   actions and setpgid becomes POSIX_SPAWN_SETPGROUP. Redirection targets
+   are opened here in the parent so errors are reported like redirect_io
+   does. Returns the pid, or if nothing was started minus the status the
+   stage gets: -1 (redirection), -126 (not executable), -127 (not found). */
+static pid_t spawn_stage_posix(cmd_t *c, const char *exec_path, int in_fd, int out_fd,
+                               pid_t pgid, bool foreground) {
+    if (!exec_path) {
+        fprintf(stderr, "mysh: command not found: %s\n", c->argv[0]);
+        return -127;
+    }
+
+    int redir_in = -1, redir_out = -1;
+    if (c->infile) {
+        redir_in = open(c->infile, O_RDONLY | O_CLOEXEC);
+        if (redir_in < 0) { perror("open infile"); return -1; }
+    }
+    if (c->outfile) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (c->append ? O_APPEND : O_TRUNC);
+        redir_out = open(c->outfile, flags, 0644);
+        if (redir_out < 0) {
+            perror("open outfile");
+            if (redir_in >= 0) close(redir_in);
+            return -1;
+        }
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+    /* take the terminal in the child, before exec, like the fork path;
+       first, while stdin is still the terminal and not a pipe */
+    if (foreground && interactive) posix_spawn_file_actions_addtcsetpgrp_np(&fa, STDIN_FILENO);
+#endif
+#endif
+    if (redir_in >= 0) posix_spawn_file_actions_adddup2(&fa, redir_in, STDIN_FILENO);
+    else if (in_fd >= 0) posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    if (redir_out >= 0) posix_spawn_file_actions_adddup2(&fa, redir_out, STDOUT_FILENO);
+    else if (out_fd >= 0) posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t dfl, empty;
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGINT);
+    sigaddset(&dfl, SIGTSTP);
+    sigaddset(&dfl, SIGQUIT);
+    sigaddset(&dfl, SIGTTIN);
+    sigaddset(&dfl, SIGTTOU);
+    sigaddset(&dfl, SIGCHLD);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    extern char **environ;
+    pid_t p;
+    int err = posix_spawn(&p, exec_path, &fa, &attr, c->argv, environ);
+    /* stale hash entry: retry through a fresh PATH search */
+    if (err == ENOENT && exec_path != c->argv[0])
+        err = posix_spawnp(&p, c->argv[0], &fa, &attr, c->argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (redir_in >= 0) close(redir_in);
+    if (redir_out >= 0) close(redir_out);
+
+    if (err != 0) {
+        if (err == ENOENT) fprintf(stderr, "mysh: command not found: %s\n", c->argv[0]);
+        else fprintf(stderr, "mysh: %s: %s\n", c->argv[0], strerror(err));
+        return err == ENOENT ? -127 : -126;
+    }
+    return p;
+}
+
+/* ---------- Coprocesses ---------- */
+/* coproc [-n N] NAME cmd [args] keeps N copies of cmd running as one
+   quiet background job, each with a pipe to its stdin and one from its
+   stdout. Requests are single lines handed to the workers round-robin
+   and each must answer with exactly one line, so a tool that is run
+   thousands of times pays fork+exec once per worker instead of once per
+   call. The worker has to flush per line (awk fflush(), jq --unbuffered,
+   sed -u, grep --line-buffered). */
+
+typedef struct {
+    pid_t pid;
+    int in_fd;              /* worker's stdin */
+    int out_fd;             /* worker's stdout */
+    char *buf;              /* unread reply bytes [start, len) */
+    size_t start, len, cap;
+} coproc_worker_t;
+
+typedef struct {
+    const char *name;       /* interned */
+    char *cmdline;
+    pid_t pgid;
+    coproc_worker_t *w;
+    int nworkers;
+    int next;               /* round-robin cursor */
+    unsigned long served;
+} coproc_t;
+
+static strmap_t coproc_map;
+static coproc_t **coprocs = NULL;
+static int coproc_count = 0;
+static int coproc_cap = 0;
+
+/* One line from a raw fd (no trailing '\n'), valid until the next call.
+   NULL at EOF, on error, or when Ctrl-C interrupts the wait. */
+static char *fd_read_line(int fd, char **bufp, size_t *startp, size_t *lenp, size_t *capp, size_t *n) {
+    for (;;) {
+        char *s = *bufp + *startp;
+        char *nl = *lenp > *startp ? memchr(s, '\n', *lenp - *startp) : NULL;
+        if (nl) {
+            *nl = '\0';
+            *n = (size_t)(nl - s);
+            *startp = (size_t)(nl - *bufp) + 1;
+            return s;
+        }
+        if (*startp > 0) {
+            memmove(*bufp, s, *lenp - *startp);
+            *lenp -= *startp;
+            *startp = 0;
+        }
+        if (*capp - *lenp < 4096) {
+            size_t cap = *capp ? *capp * 2 : 8192;
+            char *nb = realloc(*bufp, cap);
+            if (!nb) { perror("realloc"); exit(1); }
+            *bufp = nb;
+            *capp = cap;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, 100);
+        if (got_sigint) return NULL;
+        if (pr < 0 && errno != EINTR) return NULL;
+        if (pr <= 0) continue;
+        ssize_t r = read(fd, *bufp + *lenp, *capp - *lenp - 1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            /* last line without a newline */
+            if (*lenp == 0) return NULL;
+            (*bufp)[*lenp] = '\0';
+            *n = *lenp;
+            *startp = *lenp = 0;
+            return *bufp;
+        }
+        *lenp += (size_t)r;
+    }
+}
+
+static char *coproc_reply(coproc_worker_t *w, size_t *n) {
+    return fd_read_line(w->out_fd, &w->buf, &w->start, &w->len, &w->cap, n);
+}
+
+static bool write_all(int fd, const char *s, size_t n) {
+    while (n > 0) {
+        ssize_t r = write(fd, s, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        s += r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+/* Hand one request line to w (the '\n' is added here) */
+static bool coproc_request(coproc_worker_t *w, const char *line, size_t n) {
+    struct iovec iov[2] = { { (void *)line, n }, { "\n", 1 } };
+    ssize_t r;
+    do r = writev(w->in_fd, iov, 2); while (r < 0 && errno == EINTR);
+    if (r < 0) return false;
+    if ((size_t)r == n + 1) return true;
+    /* short write on a full pipe: finish it the slow way */
+    if ((size_t)r < n && !write_all(w->in_fd, line + r, n - (size_t)r)) return false;
+    return write_all(w->in_fd, "\n", 1);
+}
+
+static void coproc_close_fds(coproc_t *cp) {
+    for (int i = 0; i < cp->nworkers; i++) {
+        if (cp->w[i].in_fd >= 0) close(cp->w[i].in_fd);
+        if (cp->w[i].out_fd >= 0) close(cp->w[i].out_fd);
+        cp->w[i].in_fd = cp->w[i].out_fd = -1;
+    }
+}
+
+static void coproc_free(coproc_t *cp) {
+    for (int i = 0; i < cp->nworkers; i++) free(cp->w[i].buf);
+    free(cp->w);
+    free(cp->cmdline);
+    free(cp);
+}
+
+static int coproc_start(const char *name, int nworkers, int argc, char **argv) {
+    if (strmap_get(&coproc_map, name)) {
+        print_cyberpunk_error("coproc: already running (coproc stop NAME first)");
+        return 1;
+    }
+    if (is_builtin(argv[0])) {
+        print_cyberpunk_error("coproc: worker must be an external command");
+        return 1;
+    }
+    cmd_t c = { .argv = argv, .argc = argc };
+    const char *exec_path = NULL;
+    if (strchr(argv[0], '/')) exec_path = argv[0];
+    else {
+        cmd_hash_entry_t *e = hash_lookup(argv[0]);
+        if (e) { e->hits++; exec_path = e->path; }
+    }
+
+    coproc_t *cp = calloc(1, sizeof(*cp));
+    if (!cp) { perror("calloc"); exit(1); }
+    cp->w = calloc((size_t)nworkers, sizeof(coproc_worker_t));
+    if (!cp->w) { perror("calloc"); exit(1); }
+    pid_t *pids = arena_alloc(&line_arena, sizeof(pid_t) * (size_t)nworkers);
+
+    for (int i = 0; i < nworkers; i++) {
+        coproc_worker_t *w = &cp->w[i];
+        w->in_fd = w->out_fd = -1;
+        int req[2], resp[2];
+        if (pipe2(req, O_CLOEXEC) < 0) { perror("pipe2"); break; }
+        if (pipe2(resp, O_CLOEXEC) < 0) { perror("pipe2"); close(req[0]); close(req[1]); break; }
+        w->pid = spawn_stage_posix(&c, exec_path, req[0], resp[1], cp->pgid, false);
+        close(req[0]);
+        close(resp[1]);
+        w->in_fd = req[1];
+        w->out_fd = resp[0];
+        cp->nworkers++;
+        pids[i] = w->pid;
+        if (w->pid < 0) break;
+        if (cp->pgid == 0) cp->pgid = w->pid;
+    }
+    if (cp->nworkers < nworkers || cp->w[cp->nworkers - 1].pid < 0) {
+        coproc_close_fds(cp);
+        if (cp->pgid > 0) kill(-cp->pgid, SIGTERM);
+        coproc_free(cp);
+        return 1;
+    }
+
+    cp->name = intern(name);
+    cp->cmdline = strdup_safe(sb_join(argv, 0, argc));
+    add_job(cp->pgid, cp->cmdline, JOB_RUNNING, pids, NULL, nworkers)->quiet = true;
+    strmap_put(&coproc_map, cp->name, cp);
+    ptr_array_push((void ***)&coprocs, &coproc_count, &coproc_cap, cp);
+
+    char var[256], pid[32];
+    snprintf(var, sizeof(var), "%s_PID", name);
+    snprintf(pid, sizeof(pid), "%d", (int)cp->pgid);
+    set_transient_var(var, pid);
+
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "COPROC" CLR_DARK_GRAY "] "
+           CLR_LIGHT_GRAY "%s: %d worker%s, pgid %d\n" CLR_RESET,
+           name, nworkers, nworkers == 1 ? "" : "s", (int)cp->pgid);
+    return 0;
+}
+
+/* send: one request to the next worker, its reply to stdout */
+static int coproc_send(coproc_t *cp, int argc, char **argv) {
+    char *line = sb_join(argv, 0, argc);
+    coproc_worker_t *w = &cp->w[cp->next];
+    cp->next = (cp->next + 1) % cp->nworkers;
+    got_sigint = 0;
+    size_t n;
+    char *reply = NULL;
+    if (coproc_request(w, line, strlen(line))) reply = coproc_reply(w, &n);
+    if (!reply) {
+        print_cyberpunk_error("coproc: worker did not answer");
+        return 1;
+    }
+    cp->served++;
+    out_write(reply, n);
+    out_write("\n", 1);
+    return 0;
+}
+
+/* feed: stream a file (default stdin) through the pool, keeping one
+   request in flight per worker; replies come out in input order. stdin
+   is read raw - stdio's buffer belongs to the script reader. */
+static int coproc_feed(coproc_t *cp, const char *path) {
+    int fd = STDIN_FILENO;
+    if (path && (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        print_cyberpunk_error("coproc: cannot open feed file");
+        return 1;
+    }
+    char *buf = NULL;
+    size_t start = 0, len = 0, cap = 0, n;
+    int head = 0, inflight = 0, rc = 0;
+    bool eof = false;
+    got_sigint = 0;
+    while (!got_sigint) {
+        /* one request per idle worker, in round-robin order */
+        while (!eof && inflight < cp->nworkers) {
+            char *line = fd_read_line(fd, &buf, &start, &len, &cap, &n);
+            if (!line) { eof = true; break; }
+            coproc_worker_t *w = &cp->w[(head + inflight) % cp->nworkers];
+            if (!coproc_request(w, line, n)) { rc = 1; eof = true; break; }
+            inflight++;
+        }
+        if (inflight == 0) break;
+        char *reply = coproc_reply(&cp->w[head], &n);
+        if (!reply) { rc = 1; break; }
+        out_write(reply, n);
+        out_write("\n", 1);
+        out_end();
+        cp->served++;
+        head = (head + 1) % cp->nworkers;
+        inflight--;
+    }
+    cp->next = head;
+    free(buf);
+    if (fd != STDIN_FILENO) close(fd);
+    if (rc) print_cyberpunk_error("coproc: worker did not answer");
+    return got_sigint ? 130 : rc;
+}
+
+/* stop: EOF to every worker, a short grace period, then SIGTERM */
+static int coproc_stop(coproc_t *cp) {
+    coproc_close_fds(cp);
+    for (int tick = 0; tick < 5; tick++) {
+        reap_children();
+        job_t *j = find_job_by_pgid(cp->pgid);
+        if (!j || j->state == JOB_DONE) break;
+        struct pollfd pfd = { .fd = sigchld_fd, .events = POLLIN };
+        poll(&pfd, 1, 100);
+        if (tick == 4) kill(-cp->pgid, SIGTERM);
+    }
+    reap_children();
+
+    char var[256];
+    snprintf(var, sizeof(var), "%s_PID", cp->name);
+    unset_shell_var(var);
+    strmap_del(&coproc_map, cp->name);
+    ptr_array_remove((void **)coprocs, &coproc_count, cp);
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "COPROC" CLR_DARK_GRAY "] "
+           CLR_LIGHT_GRAY "%s stopped after %lu request%s\n" CLR_RESET,
+           cp->name, cp->served, cp->served == 1 ? "" : "s");
+    coproc_free(cp);
+    return 0;
+}
+
+static int coproc_list(void) {
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "%27s%s%27s" CLR_DARK_GRAY "│\n" CLR_RESET, "", "COPROCESSES", "");
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    if (coproc_count == 0) print_content_line("(none)", "coproc [-n N] NAME cmd [args]");
+    for (int i = 0; i < coproc_count; i++) {
+        coproc_t *cp = coprocs[i];
+        job_t *j = find_job_by_pgid(cp->pgid);
+        char detail[128];
+        snprintf(detail, sizeof(detail), "%dx %.20s, %lu served, %s",
+                 cp->nworkers, cp->cmdline, cp->served,
+                 j && j->state != JOB_DONE ? "up" : "exited");
+        print_content_line(cp->name, detail);
+    }
+    print_bottom_border();
+    return 0;
+}
+
+/* coproc [-n N] NAME cmd [args] | coproc send NAME text... |
+   coproc feed NAME [file] | coproc stop NAME | coproc */
+static int builtin_coproc(int argc, char **argv) {
+    if (argc == 1) return coproc_list();
+
+    const char *sub = argv[1];
+    if (strcmp(sub, "send") == 0 || strcmp(sub, "feed") == 0 || strcmp(sub, "stop") == 0) {
+        if (argc < 3) {
+            print_cyberpunk_error("coproc send|feed|stop NAME");
+            return 1;
+        }
+        coproc_t *cp = strmap_get(&coproc_map, argv[2]);
+        if (!cp) {
+            print_cyberpunk_error("coproc: no such coprocess");
+            return 1;
+        }
+        /* a worker that died leaves EOF behind; SIGPIPE must not take us too */
+        struct sigaction ign = { .sa_handler = SIG_IGN }, old;
+        sigemptyset(&ign.sa_mask);
+        sigaction(SIGPIPE, &ign, &old);
+        int rc = sub[0] == 's' && sub[1] == 't' ? coproc_stop(cp)
+               : sub[0] == 's' ? coproc_send(cp, argc - 3, argv + 3)
+               : coproc_feed(cp, argc > 3 ? argv[3] : NULL);
+        sigaction(SIGPIPE, &old, NULL);
+        return rc;
+    }
+
+    int i = 1;
+    long n = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+        n = atol(argv[i+1]);
+        i += 2;
+    } else if (i < argc && strncmp(argv[i], "-n", 2) == 0 && argv[i][2]) {
+        n = atol(argv[i] + 2);
+        i++;
+    }
+    if (i + 1 >= argc || n < 1 || n > 256) {
+        print_cyberpunk_error("coproc [-n N] NAME cmd [args]");
+        return 1;
+    }
+    return coproc_start(argv[i], (int)n, argc - i - 1, argv + i + 1);
+}
+
+/* ---------- Command result cache ---------- */
+/* cache [--ttl SEC] [--watch FILE]... cmd [args] runs cmd once with its
+   stdout and stderr captured, and replays both plus the exit status for
+   later calls with the same argv, working directory and key variables
+   (the names in $MYSH_CACHE_ENV, default PATH), as long as the result is
+   younger than the TTL and every watched file still has the mtime it had
+   when cmd ran. Each result is one blob - header, key, watch records,
+   stdout, stderr - kept in a small in-memory LRU and written through to
+   ~/.mysh_cache/, so another shell (a script) maps it instead of running
+   the command again. */
+
+#define CACHE_MAGIC "MYSHCACH"
+#define CACHE_VERSION 1
+#define CACHE_TTL_DEFAULT 30
+#define CACHE_MEM_ENTRIES 64
+#define CACHE_MEM_BYTES (16u << 20)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t status;
+    int64_t created;            /* CLOCK_REALTIME ns: shared across shells */
+    uint32_t key_len, nwatch;   /* key is NUL-terminated, padded to 8 */
+    uint64_t out_len, err_len;
+} cache_header_t;
+
+/* Then the path, NUL-terminated and padded to 8 */
+typedef struct {
+    int64_t mtime;              /* ns, -1 when the file was missing */
+    uint32_t len, pad;
+} cache_watch_t;
+
+typedef struct cache_entry {
+    char *key;
+    char *blob;                 /* malloc'd, or a mapping of the disk file */
+    size_t len;
+    bool mapped;
+    struct cache_entry *prev, *next;
+} cache_entry_t;
+
+static struct {
+    strmap_t map;
+    cache_entry_t *head, *tail; /* most recently used first */
+    int count;
+    size_t bytes;
+    unsigned long mem_hits, disk_hits, misses;
+} cache;
+
+static size_t pad8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static int64_t now_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t file_mtime_ns(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? stat_mtime_ns(&st) : -1;
+}
+
+static const char *cache_dir(void) {
+    static char *path;
+    if (!path) path = home_file(".mysh_cache");
+    return path;
+}
+
+static char *cache_file(const char *key) {
+    char *p = malloc(strlen(cache_dir()) + 32);
+    if (!p) { perror("malloc"); exit(1); }
+    sprintf(p, "%s/%08x.cache", cache_dir(), mem_hash(key, strlen(key)));
+    return p;
+}
+
+/* argv, cwd and the key variables, separated by \x1f / \x1e */
+static char *cache_key(int argc, char **argv) {
+    strbuf_t b = {0};
+    sb_reserve(&b, 0);
+    for (int i = 0; i < argc; i++) { sb_puts(&b, argv[i]); sb_putc(&b, '\x1f'); }
+    sb_putc(&b, '\x1e');
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) sb_puts(&b, cwd);
+    const char *names = lookup_var("MYSH_CACHE_ENV");
+    if (!names) names = "PATH";
+    for (const char *p = names; *p; ) {
+        while (*p == ' ' || *p == ':' || *p == ',') p++;
+        const char *e = p;
+        while (*e && *e != ' ' && *e != ':' && *e != ',') e++;
+        if (e == p) break;
+        char name[128];
+        snprintf(name, sizeof(name), "%.*s", (int)(e - p), p);
+        const char *v = lookup_var(name);
+        sb_putc(&b, '\x1e');
+        sb_puts(&b, name);
+        if (v) { sb_putc(&b, '='); sb_puts(&b, v); }
+        p = e;
+    }
+    return b.s;
+}
+
+/* Bounds-checks a blob; on success out/err point into it */
+static bool cache_blob_parse(const char *blob, size_t len, const char *key,
+                             const char **out, const char **err) {
+    const cache_header_t *h = (const cache_header_t *)blob;
+    if (len < sizeof(*h) || memcmp(h->magic, CACHE_MAGIC, 8) != 0 || h->version != CACHE_VERSION) return false;
+    size_t off = sizeof(*h);
+    if (pad8((size_t)h->key_len + 1) > len - off || blob[off + h->key_len] != '\0') return false;
+    if (key && strcmp(blob + off, key) != 0) return false;
+    off += pad8((size_t)h->key_len + 1);
+    for (uint32_t i = 0; i < h->nwatch; i++) {
+        if (len - off < sizeof(cache_watch_t)) return false;
+        const cache_watch_t *w = (const cache_watch_t *)(blob + off);
+        off += sizeof(*w);
+        if (pad8((size_t)w->len + 1) > len - off || blob[off + w->len] != '\0') return false;
+        off += pad8((size_t)w->len + 1);
+    }
+    if (h->out_len > len - off || h->err_len > len - off - h->out_len) return false;
+    *out = blob + off;
+    *err = blob + off + h->out_len;
+    return true;
+}
+
+/* Young enough, and every watched file unchanged */
+static bool cache_blob_fresh(const char *blob, long ttl) {
+    const cache_header_t *h = (const cache_header_t *)blob;
+    if (now_realtime_ns() - h->created >= (int64_t)ttl * 1000000000) return false;
+    size_t off = sizeof(*h) + pad8((size_t)h->key_len + 1);
+    for (uint32_t i = 0; i < h->nwatch; i++) {
+        const cache_watch_t *w = (const cache_watch_t *)(blob + off);
+        off += sizeof(*w);
+        if (file_mtime_ns(blob + off) != w->mtime) return false;
+        off += pad8((size_t)w->len + 1);
+    }
+    return true;
+}
+
+static void cache_unlink_entry(cache_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else cache.head = e->next;
+    if (e->next) e->next->prev = e->prev; else cache.tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void cache_push_front(cache_entry_t *e) {
+    e->next = cache.head;
+    if (cache.head) cache.head->prev = e;
+    cache.head = e;
+    if (!cache.tail) cache.tail = e;
+}
+
+static void cache_drop(cache_entry_t *e) {
+    cache_unlink_entry(e);
+    strmap_del(&cache.map, e->key);
+    cache.count--;
+    cache.bytes -= e->len;
+    if (e->mapped) munmap(e->blob, e->len);
+    else free(e->blob);
+    free(e->key);
+    free(e);
+}
+
+/* Takes ownership of blob; evicts from the cold end (the disk copy stays) */
+static cache_entry_t *cache_insert(const char *key, char *blob, size_t len, bool mapped) {
+    cache_entry_t *old = strmap_get(&cache.map, key);
+    if (old) cache_drop(old);
+    cache_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) { perror("calloc"); exit(1); }
+    e->key = strdup_safe(key);
+    e->blob = blob;
+    e->len = len;
+    e->mapped = mapped;
+    strmap_put(&cache.map, e->key, e);
+    cache_push_front(e);
+    cache.count++;
+    cache.bytes += len;
+    while (cache.tail != e && (cache.count > CACHE_MEM_ENTRIES || cache.bytes > CACHE_MEM_BYTES))
+        cache_drop(cache.tail);
+    return e;
+}
+
+/* Memory first, then the disk store; NULL when neither has it */
+static cache_entry_t *cache_find(const char *key) {
+    cache_entry_t *e = strmap_get(&cache.map, key);
+    if (e) {
+        cache_unlink_entry(e);
+        cache_push_front(e);
+        return e;
+    }
+    char *path = cache_file(key);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
+    const char *out, *err;
+    if (!cache_blob_parse(m, (size_t)st.st_size, key, &out, &err)) {
+        munmap(m, (size_t)st.st_size);
+        return NULL;
+    }
+    return cache_insert(key, m, (size_t)st.st_size, true);
+}
+
+static void cache_write_disk(const char *key, const char *blob, size_t len) {
+    if (mkdir(cache_dir(), 0700) != 0 && errno != EEXIST) return;
+    char *path = cache_file(key);
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        bool ok = write_all(fd, blob, len);
+        if (close(fd) != 0 || !ok || rename(tmp, path) != 0) unlink(tmp);
+    }
+    free(path);
+}
+
+/* Runs argv as a pipeline with fds 1 and 2 pointing at out_fd/err_fd */
+static int cache_run(int argc, char **argv, int out_fd, int err_fd) {
+    out_flush();
+    fflush(stderr);
+    int saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    out_setup();
+
+    pipeline_t pl = {0};
+    cmd_t *c = pipeline_push_cmd(&pl, &(cmd_t){ .argc = 0 });
+    for (int i = 0; i < argc; i++) cmd_push_arg(c, argv[i]);
+    int rc = execute_pipeline(&pl, sb_join(argv, 0, argc));
+
+    out_flush();
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    out_setup();
+    return rc;
+}
+
+static char *cache_capture(const char *key, int argc, char **argv, char **watch, int nwatch,
+                           size_t *len_out) {
+    int out_fd = memfd_create("mysh-cache-out", MFD_CLOEXEC);
+    int err_fd = memfd_create("mysh-cache-err", MFD_CLOEXEC);
+    if (out_fd < 0 || err_fd < 0) {
+        perror("memfd_create");
+        if (out_fd >= 0) close(out_fd);
+        if (err_fd >= 0) close(err_fd);
+        return NULL;
+    }
+    /* mtimes before the run: a change made while cmd runs invalidates it */
+    int64_t *mtimes = arena_alloc(&line_arena, sizeof(int64_t) * (size_t)(nwatch + 1));
+    for (int i = 0; i < nwatch; i++) mtimes[i] = file_mtime_ns(watch[i]);
+    int64_t created = now_realtime_ns();
+    int rc = cache_run(argc, argv, out_fd, err_fd);
+
+    struct stat so, se;
+    fstat(out_fd, &so);
+    fstat(err_fd, &se);
+    size_t key_len = strlen(key);
+    size_t len = sizeof(cache_header_t) + pad8(key_len + 1);
+    for (int i = 0; i < nwatch; i++) len += sizeof(cache_watch_t) + pad8(strlen(watch[i]) + 1);
+    size_t body = len;
+    len += (size_t)so.st_size + (size_t)se.st_size;
+
+    char *blob = calloc(1, len);
+    if (!blob) { perror("calloc"); exit(1); }
+    cache_header_t *h = (cache_header_t *)blob;
+    memcpy(h->magic, CACHE_MAGIC, 8);
+    h->version = CACHE_VERSION;
+    h->status = rc;
+    h->created = created;
+    h->key_len = (uint32_t)key_len;
+    h->nwatch = (uint32_t)nwatch;
+    h->out_len = (uint64_t)so.st_size;
+    h->err_len = (uint64_t)se.st_size;
+    size_t off = sizeof(*h);
+    memcpy(blob + off, key, key_len);
+    off += pad8(key_len + 1);
+    for (int i = 0; i < nwatch; i++) {
+        cache_watch_t *w = (cache_watch_t *)(blob + off);
+        w->mtime = mtimes[i];
+        w->len = (uint32_t)strlen(watch[i]);
+        off += sizeof(*w);
+        memcpy(blob + off, watch[i], w->len);
+        off += pad8((size_t)w->len + 1);
+    }
+    bool ok = pread(out_fd, blob + body, (size_t)so.st_size, 0) == so.st_size &&
+              pread(err_fd, blob + body + so.st_size, (size_t)se.st_size, 0) == se.st_size;
+    close(out_fd);
+    close(err_fd);
+    if (!ok) { free(blob); return NULL; }
+    *len_out = len;
+    return blob;
+}
+
+static void cache_replay(const char *blob, size_t len) {
+    const char *out, *err;
+    cache_blob_parse(blob, len, NULL, &out, &err);
+    const cache_header_t *h = (const cache_header_t *)blob;
+    out_write(out, (size_t)h->out_len);
+    out_flush();
+    if (!write_all(STDERR_FILENO, err, (size_t)h->err_len)) clearerr(stderr);
+}
+
+static int cache_clear(void) {
+    while (cache.head) cache_drop(cache.head);
+    int removed = 0;
+    DIR *d = opendir(cache_dir());
+    if (d) {
+        struct dirent *de;
+        while ((de = readdir(d))) {
+            size_t n = strlen(de->d_name);
+            if (n < 6 || strcmp(de->d_name + n - 6, ".cache") != 0) continue;
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", cache_dir(), de->d_name);
+            if (unlink(path) == 0) removed++;
+        }
+        closedir(d);
+    }
+    out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "CACHE" CLR_DARK_GRAY "] "
+           CLR_LIGHT_GRAY "cleared (%d stored result%s removed)\n" CLR_RESET, removed, removed == 1 ? "" : "s");
+    return 0;
+}
+
+static int cache_stats(void) {
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                          COMMAND CACHE                          " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    char line[64];
+    snprintf(line, sizeof(line), "%d entries, %.1f KiB", cache.count, (double)cache.bytes / 1024.0);
+    print_content_line("memory", line);
+    snprintf(line, sizeof(line), "%lu memory, %lu disk, %lu run", cache.mem_hits, cache.disk_hits, cache.misses);
+    print_content_line("lookups", line);
+    snprintf(line, sizeof(line), "%.42s", cache_dir());
+    print_content_line("store", line);
+    print_bottom_border();
+    return 0;
+}
+
+static int builtin_cache(int argc, char **argv) {
+    long ttl = CACHE_TTL_DEFAULT;
+    char **watch = arena_alloc(&line_arena, sizeof(char *) * (size_t)argc);
+    int nwatch = 0, i = 1;
+    if (argc == 1) return cache_stats();
+    if (argc == 2 && strcmp(argv[1], "--clear") == 0) return cache_clear();
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        if (i + 1 < argc && strcmp(argv[i], "--ttl") == 0) ttl = atol(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--watch") == 0) watch[nwatch++] = argv[++i];
+        else { i = argc; break; }
+    }
+    if (i >= argc || ttl < 1) {
+        print_cyberpunk_error("cache [--ttl SEC] [--watch FILE]... cmd [args] | cache --clear");
+        return 1;
+    }
+
+    uint64_t t0 = trace_begin();
+    char *key = cache_key(argc - i, argv + i);
+    cache_entry_t *e = strmap_get(&cache.map, key);
+    bool in_memory = e != NULL;
+    e = cache_find(key);
+    if (e && cache_blob_fresh(e->blob, ttl)) {
+        if (in_memory) cache.mem_hits++; else cache.disk_hits++;
+        cache_replay(e->blob, e->len);
+        trace_end_detail("cache", t0, in_memory ? "memory hit" : "disk hit");
+        return ((const cache_header_t *)e->blob)->status;
+    }
+
+    cache.misses++;
+    size_t len;
+    char *blob = cache_capture(key, argc - i, argv + i, watch, nwatch, &len);
+    if (!blob) return 1;
+    cache_write_disk(key, blob, len);
+    e = cache_insert(key, blob, len, false);
+    cache_replay(e->blob, e->len);
+    trace_end_detail("cache", t0, "miss");
+    return ((const cache_header_t *)e->blob)->status;
+}
+
+/* ---------- In-process pipeline stages ---------- */
+/* Two kinds of foreground pipeline stage run inside the shell instead of
+   in a child: read-only builtins that only produce output (their stdout
+   is pointed at the stage's pipe or redirect for the duration), and a
+   plain `cat`, which is serviced by a thread moving data with splice(2)
+   so it never crosses user space when either end is a pipe. Both are
+   skipped with MYSH_SPAWN=fork.
+   Ctrl-C and Ctrl-Z only reach child processes, so a cat thread must
+   finish once its neighbours die: its input has to end on its own, and
+   the pipeline needs at least one child. */
+
+static bool inproc_builtin(const cmd_t *c) {
+    static const char *output_only[] = {
+        "help", "history", "histsearch", "aliases", "vars", "jobs", "times", NULL
+    };
+    for (int i = 0; output_only[i]; i++) if (strcmp(c->argv[0], output_only[i]) == 0) return true;
+    /* listing forms only; anything else changes shell state */
+    return c->argc == 1 && (strcmp(c->argv[0], "alias") == 0 || strcmp(c->argv[0], "hash") == 0);
+}
+
+/* cat [file...] with no options reading regular files or the previous
+   stage's pipe; a device or FIFO may never reach EOF */
+static bool inproc_cat(const cmd_t *c, bool has_pipe_in) {
+    if (strcmp(c->argv[0], "cat") != 0) return false;
+    for (int i = 1; i < c->argc; i++) if (c->argv[i][0] == '-') return false;
+    struct stat st;
+    if (c->argc == 1 && !c->infile) return has_pipe_in;
+    if (c->argc == 1) return stat(c->infile, &st) == 0 && S_ISREG(st.st_mode);
+    for (int i = 1; i < c->argc; i++)
+        if (stat(c->argv[i], &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    return true;
+}
+
+/* Run an output-only builtin with stdout on out_fd (or its redirect) */
+static int run_builtin_inproc(cmd_t *c, int out_fd) {
+    int target = out_fd;
+    if (c->outfile) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (c->append ? O_APPEND : O_TRUNC);
+        target = open(c->outfile, flags, 0644);
+        if (target < 0) { perror("open outfile"); return 1; }
+    }
+
+    out_flush();
+    int saved = -1;
+    if (target >= 0) {
+        saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(target, STDOUT_FILENO);
+        out_setup();
+    }
+    /* a reader that quits early must cost us EPIPE, not the shell */
+    struct sigaction ign = { .sa_handler = SIG_IGN }, old;
+    sigemptyset(&ign.sa_mask);
+    sigaction(SIGPIPE, &ign, &old);
+
+    int rc = run_builtin(c->argc, c->argv);
+    out_flush();
+    clearerr(stdout);
+
+    sigaction(SIGPIPE, &old, NULL);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        out_setup();
+    }
+    if (c->outfile) close(target);
+    if (out_fd >= 0) close(out_fd);
+    return rc;
+}
+
+/* Heap-allocated with copies of the file names, since a stage of a job
+   stopped by Ctrl-Z outlives the command line. The thread and the shell
+   each drop one reference; the last one frees it. */
+typedef struct {
+    pthread_t thread;
+    int in_fd;          /* pipe or infile; -1 when reading files */
+    int out_fd;         /* pipe, outfile or a dup of stdout */
+    char **files;
+    int nfiles;
+    int status;
+    atomic_int refs;
+} cat_stage_t;
+
+static void cat_stage_unref(cat_stage_t *cs) {
+    if (atomic_fetch_sub(&cs->refs, 1) == 1) free(cs);
+}
+
+/* Copy in to out without a user-space buffer where the kernel allows:
+   splice when one side is a pipe, copy_file_range between two files,
+   and a plain read/write loop otherwise (e.g. to a terminal). */
+static int splice_copy(int in, int out) {
+    enum { USE_SPLICE, USE_COPY_RANGE, USE_RW } mode = USE_SPLICE;
+    char buf[65536];
+    for (;;) {
+        ssize_t n;
+        if (mode == USE_SPLICE) {
+            n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && errno == EINVAL) { mode = USE_COPY_RANGE; continue; }
+        } else if (mode == USE_COPY_RANGE) {
+            n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+            if (n < 0 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EBADF)) {
+                mode = USE_RW;
+                continue;
+            }
+        } else {
+            n = read(in, buf, sizeof(buf));
+            for (ssize_t off = 0; n > 0 && off < n; ) {
+                ssize_t w = write(out, buf + off, (size_t)(n - off));
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    return -1;
+                }
+                off += w;
+            }
+        }
+        if (n == 0) return 0;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+    }
+}
+
+static void *cat_stage_thread(void *arg) {
+    cat_stage_t *cs = arg;
+    /* EPIPE from a departed reader stays a return value in this thread */
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    cs->status = 0;
+    if (cs->nfiles == 0) {
+        if (splice_copy(cs->in_fd, cs->out_fd) < 0 && errno != EPIPE) cs->status = 1;
+    }
+    for (int i = 0; i < cs->nfiles; i++) {
+        int fd = open(cs->files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "cat: %s: %s\n", cs->files[i], strerror(errno));
+            cs->status = 1;
+            continue;
+        }
+        int r = splice_copy(fd, cs->out_fd);
+        int err = errno;
+        close(fd);
+        if (r < 0) {
+            if (err == EPIPE) break;
+            fprintf(stderr, "cat: %s: %s\n", cs->files[i], strerror(err));
+            cs->status = 1;
+        }
+    }
+    if (cs->in_fd >= 0) close(cs->in_fd);
+    close(cs->out_fd);
+    cat_stage_unref(cs);
+    return NULL;
+}
+
+/* Start a cat stage; fds passed in are dups the thread owns and closes */
+static cat_stage_t *cat_stage_start(cmd_t *c, int in_fd, int out_fd) {
+    int nfiles = c->argc - 1;
+    size_t bytes = sizeof(cat_stage_t) + sizeof(char *) * (size_t)nfiles;
+    for (int i = 0; i < nfiles; i++) bytes += strlen(c->argv[i + 1]) + 1;
+    cat_stage_t *cs = calloc(1, bytes);
+    if (!cs) { perror("calloc"); exit(1); }
+    cs->files = (char **)(cs + 1);
+    char *names = (char *)(cs->files + nfiles);
+    for (int i = 0; i < nfiles; i++) {
+        size_t len = strlen(c->argv[i + 1]) + 1;
+        cs->files[i] = memcpy(names, c->argv[i + 1], len);
+        names += len;
+    }
+    cs->nfiles = nfiles;
+    atomic_init(&cs->refs, 2);
+    cs->in_fd = -1;
+    cs->out_fd = -1;
+    if (cs->nfiles == 0) {
+        cs->in_fd = c->infile ? open(c->infile, O_RDONLY | O_CLOEXEC)
+                              : fcntl(in_fd, F_DUPFD_CLOEXEC, 0);
+        if (cs->in_fd < 0) { perror(c->infile ? "open infile" : "dup"); free(cs); return NULL; }
+    }
+    if (c->outfile) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (c->append ? O_APPEND : O_TRUNC);
+        cs->out_fd = open(c->outfile, flags, 0644);
+    } else {
+        cs->out_fd = fcntl(out_fd >= 0 ? out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
+    if (cs->out_fd < 0 || pthread_create(&cs->thread, NULL, cat_stage_thread, cs) != 0) {
+        perror(c->outfile ? "open outfile" : "cat");
+        if (cs->in_fd >= 0) close(cs->in_fd);
+        if (cs->out_fd >= 0) close(cs->out_fd);
+        free(cs);
+        return NULL;
+    }
+    return cs;
+}
+
+/* Collect the cat stages once the children are waited for, so a Ctrl-C
+   has already killed whatever kept a cat blocked. Those of a stopped job
+   carry on with it when it is resumed. */
+static void cat_stages_finish(cat_stage_t **cats, const char *inproc, int *st, int n, bool stopped) {
+    for (int i = 0; i < n; i++) {
+        if (inproc[i] != 'c') continue;
+        if (stopped) {
+            pthread_detach(cats[i]->thread);
+        } else {
+            pthread_join(cats[i]->thread, NULL);
+            st[i] = cats[i]->status;
         }
+        cat_stage_unref(cats[i]);
     }
-
-    print_cyberpunk_error("unset: not found");
-    return 1;
 }
 
-static int builtin_vars(int argc, char **argv) {
-    (void)argc; (void)argv;
-
-    printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                       SHELL VARIABLES                         " CLR_DARK_GRAY "│\n" CLR_RESET);
-    printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+/* ---------- Completion index ---------- */
+/* Command names come from one sorted array: builtins, aliases and the
+   executables of every PATH directory. Each PATH directory keeps its own
+   sorted executable list, rebuilt only when the directory cache hands
+   back a new listing (the directory's mtime moved). The merged array is
+   rebuilt only when one of those lists, PATH itself, or the alias set
+   changed. A Tab then costs one stat per PATH entry and a binary search. */
 
-    for (int i = 0; i < var_count; i++) {
-        printf(CLR_DARK_GRAY "│ " CLR_NEON_PURPLE "%-20s" CLR_DARK_GRAY " = " CLR_LIGHT_GRAY "%-40s" CLR_DARK_GRAY " │\n",
-               shell_vars[i].name, shell_vars[i].value);
+typedef struct {
+    char *dir;
+    unsigned long version;      /* listing indexed; 0 = none */
+    char **names;               /* sorted executables */
+    int count;
+    char *blob;                 /* storage for names */
+} path_index_t;
+
+static path_index_t *path_index = NULL;
+static int path_index_count = 0;
+static char *path_index_path = NULL;     /* PATH the entries came from */
+static const char **cmd_index = NULL;
+static int cmd_index_count = 0;
+static unsigned cmd_index_alias_gen = 0;
+static bool cmd_index_valid = false;
+
+static void path_index_reset(const char *path) {
+    for (int i = 0; i < path_index_count; i++) {
+        free(path_index[i].dir);
+        free(path_index[i].names);
+        free(path_index[i].blob);
     }
-
-    print_bottom_border();
-
-    return 0;
-}
-
-static int builtin_aliases(int argc, char **argv) {
-    (void)argc;
-    return builtin_alias(1, argv);
+    free(path_index);
+    path_index = NULL;
+    path_index_count = 0;
+    free(path_index_path);
+    path_index_path = strdup_safe(path);
+
+    int cap = 1;
+    for (const char *c = path; *c; c++) if (*c == ':') cap++;
+    path_index = calloc((size_t)cap, sizeof(path_index_t));
+    if (!path_index) { perror("calloc"); exit(1); }
+    for (const char *p = path; *p; ) {
+        size_t n = strcspn(p, ":");
+        if (n > 0) path_index[path_index_count++].dir = strndup(p, n);
+        p += n;
+        if (*p == ':') p++;
+    }
+    cmd_index_valid = false;
 }
 
-/* Builtin dispatch helper */
-static bool is_builtin(const char *cmd) {
-    const char *builtins[] = {
-        "cd","exit","mkdir","touch","clear","help","history","histsearch",
-        "jobs","fg","bg","alias","unalias","set","unset","vars","aliases", NULL
-    };
-    for (int i=0; builtins[i]; i++) if (strcmp(cmd, builtins[i])==0) return true;
-    return false;
+/* Executables of one listing, in the listing's (sorted) order */
+static void path_index_fill(path_index_t *pi, const dir_listing_t *l) {
+    free(pi->names);
+    free(pi->blob);
+    pi->names = NULL;
+    pi->blob = NULL;
+    pi->count = 0;
+    pi->version = l ? l->version : 0;
+    if (!l || l->count == 0) return;
+
+    int dfd = open(pi->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;
+    size_t bytes = 0;
+    for (int i = 0; i < l->count; i++) bytes += strlen(l->ents[i].name) + 1;
+    pi->names = malloc(sizeof(char *) * (size_t)l->count);
+    pi->blob = malloc(bytes);
+    if (!pi->names || !pi->blob) { perror("malloc"); exit(1); }
+    size_t used = 0;
+    for (int i = 0; i < l->count; i++) {
+        const dir_entry_t *e = &l->ents[i];
+        if (e->type == DT_DIR) continue;
+        struct stat st;
+        if (fstatat(dfd, e->name, &st, 0) < 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)) continue;
+        size_t n = strlen(e->name) + 1;
+        memcpy(pi->blob + used, e->name, n);
+        pi->names[pi->count++] = pi->blob + used;
+        used += n;
+    }
+    close(dfd);
 }
 
-static int run_builtin(int argc, char **argv) {
-    if (argc<=0) return 0;
-    if (strcmp(argv[0],"cd")==0) return builtin_cd(argc,argv);
-    if (strcmp(argv[0],"exit")==0) return builtin_exit(argc,argv);
-    if (strcmp(argv[0],"mkdir")==0) return builtin_mkdir(argc,argv);
-    if (strcmp(argv[0],"touch")==0) return builtin_touch(argc,argv);
-    if (strcmp(argv[0],"clear")==0) return builtin_clear(argc,argv);
-    if (strcmp(argv[0],"help")==0) return builtin_help(argc,argv);
-    if (strcmp(argv[0],"history")==0) return builtin_history(argc,argv);
-    if (strcmp(argv[0],"histsearch")==0) return builtin_histsearch(argc,argv);
-    if (strcmp(argv[0],"jobs")==0) return builtin_jobs(argc,argv);
-    if (strcmp(argv[0],"fg")==0) return builtin_fg(argc,argv);
-    if (strcmp(argv[0],"bg")==0) return builtin_bg(argc,argv);
-    if (strcmp(argv[0],"alias")==0) return builtin_alias(argc,argv);
-    if (strcmp(argv[0],"unalias")==0) return builtin_unalias(argc,argv);
-    if (strcmp(argv[0],"set")==0) return builtin_set(argc,argv);
-    if (strcmp(argv[0],"unset")==0) return builtin_unset(argc,argv);
-    if (strcmp(argv[0],"vars")==0) return builtin_vars(argc,argv);
-    if (strcmp(argv[0],"aliases")==0) return builtin_aliases(argc,argv);
-    return 127;
+static int cstr_cmp(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
 }
 
-/* ---------- Execution helpers ---------- */
+static void cmd_index_refresh(void) {
+    const char *path = lookup_var("PATH");
+    if (!path) path = "";
+    if (!path_index_path || strcmp(path, path_index_path) != 0) path_index_reset(path);
 
-/* Setup IO redirection for a child process. On failure the child exits. */
-static void redirect_io(const char *infile, const char *outfile, bool append) {
-    if (infile) {
-        int fd = open(infile, O_RDONLY);
-        if (fd < 0) { perror("open infile"); exit(1); }
-        dup2(fd, STDIN_FILENO);
-        close(fd);
-    }
-    if (outfile) {
-        int flags = O_WRONLY | O_CREAT | (append? O_APPEND : O_TRUNC);
-        int fd = open(outfile, flags, 0644);
-        if (fd < 0) { perror("open outfile"); exit(1); }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
+    for (int i = 0; i < path_index_count; i++) {
+        const dir_listing_t *l = dir_listing(path_index[i].dir);
+        if ((l ? l->version : 0) == path_index[i].version) continue;
+        path_index_fill(&path_index[i], l);
+        cmd_index_valid = false;
     }
+    if (alias_gen != cmd_index_alias_gen) cmd_index_valid = false;
+    if (cmd_index_valid) return;
+
+    int total = alias_count;
+    for (int i = 0; builtin_names[i]; i++) total++;
+    for (int i = 0; i < path_index_count; i++) total += path_index[i].count;
+    free(cmd_index);
+    cmd_index = malloc(sizeof(char *) * (size_t)(total ? total : 1));
+    if (!cmd_index) { perror("malloc"); exit(1); }
+    int n = 0;
+    for (int i = 0; builtin_names[i]; i++) cmd_index[n++] = builtin_names[i];
+    for (int i = 0; i < alias_count; i++) cmd_index[n++] = aliases[i]->name;
+    for (int i = 0; i < path_index_count; i++)
+        for (int k = 0; k < path_index[i].count; k++) cmd_index[n++] = path_index[i].names[k];
+    qsort(cmd_index, (size_t)n, sizeof(char *), cstr_cmp);
+    int u = 0;
+    for (int i = 0; i < n; i++)
+        if (u == 0 || strcmp(cmd_index[u - 1], cmd_index[i]) != 0) cmd_index[u++] = cmd_index[i];
+    cmd_index_count = u;
+    cmd_index_alias_gen = alias_gen;
+    cmd_index_valid = true;
 }
 
-/* ---------- Tab completion helper (simple file-name completion) ---------- */
-
-static char *tab_complete(const char *prefix) {
-    if (!prefix) return NULL;
-    DIR *d = opendir(".");
-    if (!d) return NULL;
-
-    struct dirent *e;
-    static char result[1024];
-    int found = 0;
-    size_t prelen = strlen(prefix);
+/* Completion candidates for word (already unquoted). Command position
+   searches cmd_index, anything else the directory the word points into;
+   names of directories get a trailing '/'. Hidden entries only match a
+   word whose last component starts with '.'. */
+static int complete_candidates(const char *word, bool command, strvec_t *out) {
+    *out = (strvec_t){0};
+    dir_cache_tick();
+    size_t wl = strlen(word);
+
+    if (command && !strchr(word, '/')) {
+        cmd_index_refresh();
+        int lo = 0, hi = cmd_index_count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (strncmp(cmd_index[mid], word, wl) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        for (int i = lo; i < cmd_index_count && strncmp(cmd_index[i], word, wl) == 0; i++)
+            strvec_push(out, (char *)cmd_index[i]);
+        return out->n;
+    }
 
-    while ((e = readdir(d))) {
-        if (strncmp(e->d_name, prefix, prelen) == 0) {
-            if (!found) {
-                strncpy(result, e->d_name, sizeof(result)-1);
-                result[sizeof(result)-1] = '\0';
-            } else {
-                /* more than one match -> ambiguous */
-                closedir(d);
-                return NULL;
-            }
-            found++;
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    char *dir = arena_strndup(&line_arena, word, slash ? (size_t)(slash - word + 1) : 0);
+    if (dir[0] == '~' && (dir[1] == '/' || !dir[1])) {
+        char *home = expand_tilde(dir);
+        dir = arena_strdup(&line_arena, home);
+        free(home);
+    }
+    const dir_listing_t *l = dir_listing(dir);
+    if (!l) return 0;
+    size_t bl = strlen(base);
+    for (int i = dir_lower_bound(l, base, bl); i < l->count; i++) {
+        const dir_entry_t *e = &l->ents[i];
+        if (strncmp(e->name, base, bl) != 0) break;
+        if (e->name[0] == '.' && base[0] != '.') continue;
+        unsigned char type = dir_entry_type(dir, e);
+        bool is_dir = type == DT_DIR;
+        if (type == DT_LNK) {
+            struct stat st;
+            char *full = arena_alloc(&line_arena, strlen(dir) + strlen(e->name) + 2);
+            sprintf(full, "%s%s", *dir ? dir : "./", e->name);
+            is_dir = stat(full, &st) == 0 && S_ISDIR(st.st_mode);
         }
+        size_t nl = strlen(e->name);
+        char *c = arena_alloc(&line_arena, nl + 2);
+        memcpy(c, e->name, nl);
+        if (is_dir) c[nl++] = '/';
+        c[nl] = '\0';
+        strvec_push(out, c);
     }
-    closedir(d);
-    return found == 1 ? result : NULL;
+    return out->n;
 }
 
 /* ---------- Pipeline execution ---------- */
 
+/* PIPESTATUS holds every stage's status of the last foreground pipeline,
+   space-separated, and PIPESTATUS_<n> each one (from 1, like
+   MYSH_LAST_RUSAGE_<n>) */
+static void publish_pipestatus(const int *st, int n) {
+    static int published = 0;
+    strbuf_t all = {0};
+    sb_reserve(&all, 0);
+    char num[16], name[32];
+    for (int i = 0; i < n; i++) {
+        snprintf(num, sizeof(num), "%d", st[i]);
+        if (i) sb_putc(&all, ' ');
+        sb_puts(&all, num);
+        snprintf(name, sizeof(name), "PIPESTATUS_%d", i + 1);
+        set_transient_var(name, num);
+    }
+    set_transient_var("PIPESTATUS", all.s);
+    for (int i = n; i < published; i++) {
+        snprintf(name, sizeof(name), "PIPESTATUS_%d", i + 1);
+        unset_shell_var(name);
+    }
+    published = n;
+}
+
 static int execute_pipeline(pipeline_t *pl, char *rawline) {
-    show_loading_bar("EXECUTING COMMAND");
+    if (!pl->quiet) show_loading_bar("EXECUTING COMMAND");
 
     /* alias expansion: for each command in the pipeline, try to expand */
+    uint64_t t_alias = trace_begin();
     for (int i = 0; i < pl->ncmds; i++) {
-        if (pl->cmds[i].argc > 0) {
-            char original_cmd[4096] = {0};
-            for (int j = 0; j < pl->cmds[i].argc; j++) {
-                if (j > 0) strncat(original_cmd, " ", sizeof(original_cmd) - strlen(original_cmd) - 1);
-                strncat(original_cmd, pl->cmds[i].argv[j], sizeof(original_cmd) - strlen(original_cmd) - 1);
-            }
-
-            char *expanded = expand_aliases(original_cmd);
-            if (strcmp(expanded, original_cmd) != 0) {
-                int new_ntoks;
-                char **new_toks = tokenize(expanded, &new_ntoks);
-
-                for (int j = 0; j < pl->cmds[i].argc; j++) {
-                    free(pl->cmds[i].argv[j]);
-                }
-
-                pl->cmds[i].argc = 0;
-                for (int j = 0; j < new_ntoks && j < MAX_ARGS-1; j++) {
-                    pl->cmds[i].argv[pl->cmds[i].argc++] = strdup_safe(new_toks[j]);
-                }
-                pl->cmds[i].argv[pl->cmds[i].argc] = NULL;
-
-                free_tokens(new_toks, new_ntoks);
-            }
-            free(expanded);
+        cmd_t *c = &pl->cmds[i];
+        int argc;
+        char **argv = alias_splice(c->argv, c->argc, &argc);
+        if (argv) {
+            c->argv = argv;
+            c->argc = argc;
+            c->argv_cap = argc + 1;
         }
     }
+    trace_end("alias", t_alias);
+
+    /* single built-in optimization (no redir/pipes/background) */
+    if (pl->ncmds==1 && pl->cmds[0].argc > 0 && is_builtin(pl->cmds[0].argv[0]) &&
+        !pl->background && !pl->cmds[0].infile && !pl->cmds[0].outfile) {
+        uint64_t t_builtin = trace_begin();
+        builtin_pipestatus = false;
+        int rc = run_builtin(pl->cmds[0].argc, pl->cmds[0].argv);
+        if (!builtin_pipestatus) publish_pipestatus(&rc, 1);
+        out_end();
+        trace_end_detail("builtin", t_builtin, pl->cmds[0].argv[0]);
+        return rc;
+    }
 
     int n = pl->ncmds;
-    int pipefds[2*(n>0?(n-1):0)];
+    /* per-stage state lives in line_arena, sized by the pipeline */
+    int *pipefds = arena_alloc(&line_arena, sizeof(int) * (size_t)(2 * n));
+    long pipe_size = n > 1 ? pipe_buf_size() : 0;
     for (int i=0;i<n-1;i++) {
-        if (pipe(pipefds + i*2) < 0) { perror("pipe"); return 1; }
+        if (!open_stage_pipe(pipefds + i*2, pipe_size)) {
+            perror("pipe");
+            for (int j=0;j<i*2;j++) close(pipefds[j]);
+            return 1;
+        }
+    }
+
+    /* Children must not inherit (and later re-flush) buffered output; in
+       script mode stdout is usually a pipe and therefore fully buffered. */
+    out_flush();
+
+    /* Resolve external commands in the parent so the hash persists */
+    uint64_t t_hash = trace_begin();
+    const char **exec_paths = arena_alloc(&line_arena, sizeof(char *) * (size_t)n);
+    for (int i=0;i<n;i++) {
+        cmd_t *c = &pl->cmds[i];
+        exec_paths[i] = NULL;
+        if (c->argc == 0 || is_builtin(c->argv[0])) continue;
+        if (strchr(c->argv[0], '/')) { exec_paths[i] = c->argv[0]; continue; }
+        cmd_hash_entry_t *e = hash_lookup(c->argv[0]);
+        if (e) { e->hits++; exec_paths[i] = e->path; }
     }
+    trace_end("hash_lookup", t_hash);
 
+    bool force_fork = use_fork_backend();
+    bool foreground = !pl->background;
+    if (foreground) usage_begin(pl);
     pid_t pgid = 0;
     pid_t p;
+    pid_t *pids = arena_alloc(&line_arena, sizeof(pid_t) * (size_t)n);
+    memset(pids, 0, sizeof(pid_t) * (size_t)n);
+    int live = 0;
+    int *st = arena_alloc(&line_arena, sizeof(int) * (size_t)n);     /* PIPESTATUS */
+    memset(st, 0, sizeof(int) * (size_t)n);
+    /* 0 = child process, 'b' = in-process builtin, 'c' = splice cat */
+    char *inproc = arena_alloc(&line_arena, (size_t)n);
+    memset(inproc, 0, (size_t)n);
+    bool has_child = false;
     for (int i=0;i<n;i++) {
         cmd_t *c = &pl->cmds[i];
         if (c->argc == 0) continue;
-
-        /* single built-in optimization (no redir/pipes/background) */
-        if (n==1 && is_builtin(c->argv[0]) && !pl->background && !c->infile && !c->outfile) {
-            return run_builtin(c->argc, c->argv);
+        if (foreground && !force_fork) {
+            if (is_builtin(c->argv[0]) && inproc_builtin(c)) { inproc[i] = 'b'; continue; }
+            if (inproc_cat(c, i > 0)) { inproc[i] = 'c'; continue; }
         }
+        has_child = true;
+    }
+    /* with no child, nothing would deliver Ctrl-C or Ctrl-Z to a cat */
+    if (!has_child) for (int i=0;i<n;i++) if (inproc[i] == 'c') inproc[i] = 0;
 
-        p = fork();
-        if (p < 0) { perror("fork"); return 1; }
-        if (p == 0) {
-            if (i==0) pgid = getpid();
-            setpgid(0, pgid);
-
-            if (!pl->background) tcsetpgrp(STDIN_FILENO, pgid);
-
-            signal(SIGINT, SIG_DFL);
-            signal(SIGTSTP, SIG_DFL);
-            signal(SIGQUIT, SIG_DFL);
+    for (int i=0;i<n;i++) {
+        cmd_t *c = &pl->cmds[i];
+        if (c->argc == 0 || inproc[i]) continue;
+
+        int in_fd = i > 0 ? pipefds[(i-1)*2] : -1;
+        int out_fd = i < n-1 ? pipefds[i*2 + 1] : -1;
+        uint64_t t_spawn = trace_begin();
+        if (force_fork || is_builtin(c->argv[0])) {
+            p = spawn_stage_fork(c, exec_paths[i], in_fd, out_fd, pipefds, 2*(n-1), pgid, foreground);
+            trace_end_detail("fork", t_spawn, c->argv[0]);
+            if (p < 0) { perror("fork"); st[i] = 1; continue; }
+        } else {
+            p = spawn_stage_posix(c, exec_paths[i], in_fd, out_fd, pgid, foreground);
+            trace_end_detail("posix_spawn", t_spawn, c->argv[0]);
+            if (p < 0) { st[i] = -p; continue; }
+        }
 
-            if (i>0) {
-                dup2(pipefds[(i-1)*2], STDIN_FILENO);
+        if (pgid == 0) {
+            pgid = p;
+            if (foreground && interactive) {
+                uint64_t t_tc = trace_begin();
+                tcsetpgrp(STDIN_FILENO, pgid);
+                trace_end("tcsetpgrp", t_tc);
             }
-            if (i < n-1) {
-                dup2(pipefds[i*2 + 1], STDOUT_FILENO);
-            }
-
-            for (int j=0;j<2*(n-1);j++) close(pipefds[j]);
-
-            redirect_io(c->infile, c->outfile, c->append);
+        }
+        setpgid(p, pgid);
+        pids[i] = p;
+        live++;
+    }
 
-            if (is_builtin(c->argv[0])) {
-                int rc = run_builtin(c->argc, c->argv);
-                exit(rc);
-            } else {
-                execvp(c->argv[0], c->argv);
-                fprintf(stderr, "mysh: command not found: %s\n", c->argv[0]);
-                exit(127);
-            }
-        } else {
-            if (i==0) {
-                pgid = p;
+    /* In-process stages get private dups of their ends, created after
+       every child exists so none of them inherits one. Builtins ignore
+       stdin, so their read side stays closed and writers upstream see
+       EPIPE. */
+    cat_stage_t **cats = arena_alloc(&line_arena, sizeof(cat_stage_t *) * (size_t)n);
+    int *builtin_out = arena_alloc(&line_arena, sizeof(int) * (size_t)n);
+    for (int i=0;i<n;i++) {
+        int out_fd = i < n-1 ? pipefds[i*2 + 1] : -1;
+        if (inproc[i] == 'b') {
+            builtin_out[i] = out_fd >= 0 ? fcntl(out_fd, F_DUPFD_CLOEXEC, 0) : -1;
+        } else if (inproc[i] == 'c') {
+            uint64_t t_cat = trace_begin();
+            cats[i] = cat_stage_start(&pl->cmds[i], i > 0 ? pipefds[(i-1)*2] : -1, out_fd);
+            if (!cats[i]) {
+                inproc[i] = 0;
+                st[i] = 1;      /* its redirection failed, as for a child */
             }
-            setpgid(p, pgid);
+            trace_end("cat_thread", t_cat);
         }
     }
+    for (int j=0;j<2*(n-1);j++) close(pipefds[j]);
 
-    for (int j=0;j<2*(n-1);j++) if (j>=0) close(pipefds[j]);
+    for (int i=0;i<n;i++) {
+        if (inproc[i] != 'b') continue;
+        uint64_t t_builtin = trace_begin();
+        st[i] = run_builtin_inproc(&pl->cmds[i], builtin_out[i]);
+        trace_end_detail("builtin", t_builtin, pl->cmds[i].argv[0]);
+    }
+    if (pgid == 0) {
+        cat_stages_finish(cats, inproc, st, n, false);
+        last_usage.running = false;
+        if (pl->background) return 0;
+        publish_pipestatus(st, n);
+        return st[n-1];
+    }
 
+    bool stopped = false;
     if (pl->background) {
-        add_job(pgid, rawline, JOB_RUNNING);
-        printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "BACKGROUND" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "Job [%d] started with PID %d\n" CLR_RESET,
+        last_bg_job = add_job(pgid, rawline, JOB_RUNNING, pids, NULL, n);
+        last_bg_job->quiet = pl->quiet;
+        if (!pl->quiet) out_printf(CLR_DARK_GRAY "[" CLR_NEON_GREEN "BACKGROUND" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "Job [%d] started with PID %d\n" CLR_RESET,
                next_job_id-1, pgid);
     } else {
         fg_pgid = pgid;
-        tcsetpgrp(STDIN_FILENO, pgid);
+        if (interactive) tcsetpgrp(STDIN_FILENO, pgid);
 
+        /* wait for every stage, not just the first one to exit */
+        uint64_t t_wait = trace_begin();
         int status;
-        while (1) {
-            pid_t w = waitpid(-pgid, &status, WUNTRACED);
+        struct rusage ru;
+        while (live > 0) {
+            pid_t w = wait4(-pgid, &status, WUNTRACED, &ru);
             if (w == -1) {
-                if (errno == ECHILD) break;
                 if (errno == EINTR) continue;
                 break;
             }
             if (WIFSTOPPED(status)) {
-                add_job(pgid, rawline, JOB_STOPPED);
+                /* the members still alive become the job */
+                for (int i = 0; i < n; i++)
+                    if (pids[i] > 0 || inproc[i] == 'c') st[i] = 128 + WSTOPSIG(status);
+                add_job(pgid, rawline, JOB_STOPPED, pids, st, n);
+                stopped = true;
                 break;
             }
-            pid_t r = waitpid(-pgid, &status, WNOHANG);
-            if (r == -1 || r == 0) {
-                break;
+            for (int i = 0; i < n; i++) {
+                if (pids[i] == w) {
+                    st[i] = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+                    usage_stage_done(i, &ru);
+                    pids[i] = 0;
+                    live--;
+                    break;
+                }
             }
         }
+        usage_end();
+        trace_end("wait", t_wait);
 
-        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        if (interactive) tcsetpgrp(STDIN_FILENO, shell_pgid);
         fg_pgid = 0;
     }
 
-    return 0;
+    cat_stages_finish(cats, inproc, st, n, stopped);
+    if (pl->background) return 0;
+    publish_pipestatus(st, n);
+    return st[n-1];
 }
 
-/* ---------- Simple input (fgets) ---------- */
+/* Runs the items whose condition holds and returns the last status.
+   A pipeline killed by Ctrl-C abandons the rest of the list. */
+static int execute_list(const cmd_list_t *list, bool quiet) {
+    int status = 0;
+    for (int i = 0; i < list->n; i++) {
+        const list_item_t *it = &list->items[i];
+        if ((it->op == LIST_AND && status != 0) || (it->op == LIST_OR && status == 0)) continue;
+        pipeline_t pl;
+        uint64_t t_parse = trace_begin();
+        int parsed = parse_line(it->text, &pl);
+        trace_end("parse", t_parse);
+        if (parsed < 0) { last_status = status = 2; continue; }
+        if (pl.ncmds == 0) continue;
+        pl.quiet = quiet;
+        /* published at once: the next item's $? is lexed after this */
+        last_status = status = execute_pipeline(&pl, it->text);
+        if (status == 128 + SIGINT) break;
+    }
+    return status;
+}
 
-/* You have a more advanced tab-readline earlier; to keep things stable
-   we read the line simply. If you want arrow-key editing or live tab
-   completion, next step (phase 2) is to re-enable the interactive reader. */
-static char *read_line_with_tab_completion(const char *prompt) {
-    printf("%s", prompt);
-    fflush(stdout);
+/* ---------- Line editor ---------- */
+/* Raw-mode editing for interactive input: cursor movement, kill keys,
+   history browsing and Tab completion. Every key ends in one redraw of
+   the input row, composed in ed_out and sent with a single write. The
+   prompt is printed once; redraws return to the column it ended in, and
+   long lines scroll horizontally. Falls back to plain getline when the
+   terminal cannot be put in raw mode or TERM is dumb. */
+
+enum {
+    KEY_NONE = -1,
+    KEY_UP = 1000, KEY_DOWN, KEY_RIGHT, KEY_LEFT, KEY_HOME, KEY_END, KEY_DELETE,
+    KEY_CHILD           /* not a key: a child changed state */
+};
 
-    static char buf[4096];
-    if (fgets(buf, sizeof(buf), stdin) == NULL) {
-        return NULL;
+typedef struct {
+    char *buf;
+    size_t len, cap, pos;
+    size_t col0;                /* column the input starts in */
+    int hist;                   /* history index; history_count = new line */
+    char *saved;                /* the new line while browsing history */
+    size_t saved_len;
+    bool last_tab;
+} editor_t;
+
+static char *ed_out = NULL;
+static size_t ed_out_len = 0, ed_out_cap = 0;
+
+static void ed_putn(const char *s, size_t n) {
+    if (ed_out_len + n > ed_out_cap) {
+        size_t cap = ed_out_cap ? ed_out_cap : 1024;
+        while (cap < ed_out_len + n) cap *= 2;
+        char *grown = realloc(ed_out, cap);
+        if (!grown) { perror("realloc"); exit(1); }
+        ed_out = grown;
+        ed_out_cap = cap;
+    }
+    memcpy(ed_out + ed_out_len, s, n);
+    ed_out_len += n;
+}
+
+static void ed_puts(const char *s) { ed_putn(s, strlen(s)); }
+
+static void ed_flush(void) {
+    size_t off = 0;
+    while (off < ed_out_len) {
+        ssize_t w = write(STDOUT_FILENO, ed_out + off, ed_out_len - off);
+        if (w < 0) { if (errno == EINTR) continue; break; }
+        off += (size_t)w;
+    }
+    ed_out_len = 0;
+}
+
+/* Columns a code point takes: 2 for the common wide (CJK, emoji) ranges */
+static int cp_width(uint32_t cp) {
+    if (cp < 0x1100) return 1;
+    if ((cp <= 0x115F) || (cp >= 0x2E80 && cp <= 0xA4CF) || (cp >= 0xAC00 && cp <= 0xD7A3) ||
+        (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0xFE30 && cp <= 0xFE4F) ||
+        (cp >= 0xFF00 && cp <= 0xFF60) || (cp >= 0xFFE0 && cp <= 0xFFE6) ||
+        (cp >= 0x1F300 && cp <= 0x1F64F) || (cp >= 0x1F900 && cp <= 0x1F9FF) || cp >= 0x20000)
+        return 2;
+    return 1;
+}
+
+/* Display width of s[0..n), skipping ANSI escape sequences */
+static size_t display_width(const char *s, size_t n) {
+    size_t w = 0;
+    for (size_t i = 0; i < n; ) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == 0x1b && i + 1 < n && s[i + 1] == '[') {
+            i += 2;
+            while (i < n && !(s[i] >= 0x40 && s[i] <= 0x7e)) i++;
+            i++;
+            continue;
+        }
+        if (c < 0x80) { w += c >= 0x20; i++; continue; }
+        int len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+        uint32_t cp = len == 1 ? c : c & (0x3f >> (len - 1));
+        for (int k = 1; k < len && i + (size_t)k < n; k++) cp = (cp << 6) | ((unsigned char)s[i + k] & 0x3f);
+        w += (size_t)cp_width(cp);
+        i += (size_t)len;
+    }
+    return w;
+}
+
+static size_t term_cols(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+static bool term_raw(struct termios *saved) {
+    if (tcgetattr(STDIN_FILENO, saved) < 0) return false;
+    struct termios raw = *saved;
+    raw.c_iflag &= ~(unsigned)(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+    raw.c_lflag &= ~(unsigned)(ECHO | ICANON | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == 0;
+}
+
+static int ed_read_byte(int timeout_ms) {
+    if (timeout_ms >= 0) {
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) <= 0) return KEY_NONE;
+    } else if (!(ev_wait() & EV_INPUT)) {
+        return KEY_CHILD;
+    }
+    unsigned char c;
+    for (;;) {
+        ssize_t r = read(STDIN_FILENO, &c, 1);
+        if (r == 1) return c;
+        if (r < 0 && errno == EINTR) continue;
+        return -2;      /* EOF or error */
+    }
+}
+
+/* One key: a byte, or KEY_* for the escape sequences we understand */
+static int ed_read_key(void) {
+    int c = ed_read_byte(-1);
+    if (c != 0x1b) return c;
+    int a = ed_read_byte(50);
+    if (a == KEY_NONE) return 0x1b;
+    if (a == 'O') {
+        int b = ed_read_byte(50);
+        return b == 'H' ? KEY_HOME : b == 'F' ? KEY_END : KEY_NONE;
+    }
+    if (a != '[') return KEY_NONE;
+    int b = ed_read_byte(50);
+    switch (b) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    }
+    if (b < '0' || b > '9') return KEY_NONE;
+    int n = b - '0', t;
+    while ((t = ed_read_byte(50)) >= '0' && t <= '9') n = n * 10 + (t - '0');
+    if (t != '~') return KEY_NONE;
+    return n == 1 || n == 7 ? KEY_HOME : n == 4 || n == 8 ? KEY_END : n == 3 ? KEY_DELETE : KEY_NONE;
+}
+
+static void ed_refresh(editor_t *e) {
+    size_t cols = term_cols();
+    size_t avail = cols > e->col0 + 2 ? cols - e->col0 - 1 : 1;
+    /* scroll so the cursor stays visible */
+    size_t start = 0;
+    while (start < e->pos && display_width(e->buf + start, e->pos - start) >= avail) {
+        start++;
+        while (start < e->pos && ((unsigned char)e->buf[start] & 0xc0) == 0x80) start++;
+    }
+    size_t end = start, w = 0;
+    while (end < e->len) {
+        size_t next = end + 1;
+        while (next < e->len && ((unsigned char)e->buf[next] & 0xc0) == 0x80) next++;
+        size_t cw = display_width(e->buf + end, next - end);
+        if (w + cw > avail) break;
+        w += cw;
+        end = next;
+    }
+
+    char move[32];
+    ed_puts("\r");
+    if (e->col0) { snprintf(move, sizeof(move), "\x1b[%zuC", e->col0); ed_puts(move); }
+    ed_putn(e->buf + start, end - start);
+    ed_puts("\x1b[0K\r");
+    size_t cur = e->col0 + display_width(e->buf + start, e->pos - start);
+    if (cur) { snprintf(move, sizeof(move), "\x1b[%zuC", cur); ed_puts(move); }
+    ed_flush();
+}
+
+static void ed_reserve(editor_t *e, size_t extra) {
+    if (e->len + extra + 1 <= e->cap) return;
+    size_t cap = e->cap ? e->cap : 256;
+    while (cap < e->len + extra + 1) cap *= 2;
+    char *grown = realloc(e->buf, cap);
+    if (!grown) { perror("realloc"); exit(1); }
+    e->buf = grown;
+    e->cap = cap;
+}
+
+static void ed_insert(editor_t *e, const char *s, size_t n) {
+    ed_reserve(e, n);
+    memmove(e->buf + e->pos + n, e->buf + e->pos, e->len - e->pos);
+    memcpy(e->buf + e->pos, s, n);
+    e->pos += n;
+    e->len += n;
+}
+
+static void ed_delete(editor_t *e, size_t from, size_t to) {
+    memmove(e->buf + from, e->buf + to, e->len - to);
+    e->len -= to - from;
+    if (e->pos > to) e->pos -= to - from;
+    else if (e->pos > from) e->pos = from;
+}
+
+static size_t ed_prev_char(const editor_t *e, size_t i) {
+    if (i == 0) return 0;
+    i--;
+    while (i > 0 && ((unsigned char)e->buf[i] & 0xc0) == 0x80) i--;
+    return i;
+}
+
+static size_t ed_next_char(const editor_t *e, size_t i) {
+    if (i >= e->len) return e->len;
+    i++;
+    while (i < e->len && ((unsigned char)e->buf[i] & 0xc0) == 0x80) i++;
+    return i;
+}
+
+static void ed_set(editor_t *e, const char *s, size_t n) {
+    e->len = 0;
+    e->pos = 0;
+    ed_insert(e, s, n);
+}
+
+static void ed_history(editor_t *e, int dir) {
+    if (history_loader.loading) {
+        /* the line started as "new" at index 0 while the loader ran */
+        history_ensure();
+        if (e->hist == 0) e->hist = history_count;
+    }
+    int to = e->hist + dir;
+    if (to < 0 || to > history_count) return;
+    if (e->hist == history_count) {
+        free(e->saved);
+        e->saved = malloc(e->len + 1);
+        if (!e->saved) { perror("malloc"); exit(1); }
+        memcpy(e->saved, e->buf, e->len);
+        e->saved_len = e->len;
+    }
+    e->hist = to;
+    if (to == history_count) ed_set(e, e->saved, e->saved_len);
+    else {
+        const hist_entry_t *h = history_at(to);
+        ed_set(e, h->text, h->len);
+    }
+}
+
+static bool is_word_break(char c) {
+    return c == ' ' || c == '\t' || is_operator_char(c);
+}
+
+/* Characters that must be escaped when a completion is inserted */
+static bool needs_escape(char c) {
+    return strchr(" \t\\'\"|&<>*?[$;", c) != NULL;
+}
+
+static void ed_list_candidates(const strvec_t *c, const char *prompt, editor_t *e) {
+    size_t maxw = 0;
+    for (int i = 0; i < c->n; i++) {
+        size_t w = display_width(c->v[i], strlen(c->v[i]));
+        if (w > maxw) maxw = w;
+    }
+    size_t cols = term_cols();
+    size_t per_row = cols / (maxw + 2);
+    if (per_row == 0) per_row = 1;
+    int shown = c->n > 200 ? 200 : c->n;
+    ed_puts("\n");
+    for (int i = 0; i < shown; i++) {
+        ed_puts(c->v[i]);
+        if ((size_t)(i + 1) % per_row == 0 || i == shown - 1) ed_puts("\n");
+        else for (size_t pad = display_width(c->v[i], strlen(c->v[i])); pad < maxw + 2; pad++) ed_puts(" ");
+    }
+    if (shown < c->n) {
+        char more[64];
+        snprintf(more, sizeof(more), "... and %d more\r\n", c->n - shown);
+        ed_puts(more);
+    }
+    ed_puts(prompt);
+    ed_refresh(e);
+}
+
+static void ed_complete(editor_t *e, const char *prompt) {
+    /* the word before the cursor, honouring backslash escapes */
+    size_t start = e->pos;
+    while (start > 0) {
+        char c = e->buf[start - 1];
+        if (is_word_break(c) && !(start >= 2 && e->buf[start - 2] == '\\')) break;
+        start--;
+    }
+    size_t k = start;
+    while (k > 0 && (e->buf[k - 1] == ' ' || e->buf[k - 1] == '\t')) k--;
+    /* start of a pipeline stage or of a list item (;, && and ||) */
+    bool command = (k == 0 || e->buf[k - 1] == '|' || e->buf[k - 1] == '&' || e->buf[k - 1] == ';');
+
+    char *word = arena_alloc(&line_arena, e->pos - start + 1);
+    size_t wl = 0;
+    for (size_t i = start; i < e->pos; i++) {
+        char c = e->buf[i];
+        if (c == '\\' && i + 1 < e->pos) c = e->buf[++i];
+        else if (c == '\'' || c == '"') continue;
+        word[wl++] = c;
+    }
+    word[wl] = '\0';
+
+    strvec_t c;
+    int n = complete_candidates(word, command, &c);
+    const char *base = strrchr(word, '/');
+    base = base && !command ? base + 1 : word;
+    size_t bl = strlen(base);
+    if (n == 0) { ed_puts("\a"); ed_flush(); return; }
+
+    /* longest common prefix of the candidates */
+    size_t lcp = strlen(c.v[0]);
+    for (int i = 1; i < n; i++) {
+        size_t j = 0;
+        while (j < lcp && c.v[i][j] == c.v[0][j]) j++;
+        lcp = j;
+    }
+    if (lcp > bl) {
+        for (size_t i = bl; i < lcp; i++) {
+            char ch = c.v[0][i];
+            if (needs_escape(ch)) ed_insert(e, "\\", 1);
+            ed_insert(e, &ch, 1);
+        }
+        if (n == 1 && c.v[0][lcp - 1] != '/') ed_insert(e, " ", 1);
+        ed_refresh(e);
+    } else if (n == 1) {
+        if (c.v[0][lcp - 1] != '/') { ed_insert(e, " ", 1); ed_refresh(e); }
+    } else if (e->last_tab) {
+        ed_list_candidates(&c, prompt, e);
+    } else {
+        ed_puts("\a");
+        ed_flush();
     }
+}
+
+/* Plain getline input, for terminals we cannot drive */
+static char *read_line_plain(const char *prompt) {
+    out_write(prompt, strlen(prompt));
+    out_flush();
 
-    size_t len = strlen(buf);
+    static char *buf = NULL;
+    static size_t cap = 0;
+    ssize_t len = getline(&buf, &cap, stdin);
+    if (len == -1) return NULL;
     if (len > 0 && buf[len-1] == '\n') {
-        buf[len-1] = '\0';
+        buf[--len] = '\0';
     }
 
-    return strdup_safe(buf);
+    return arena_strndup(&line_arena, buf, (size_t)len);
+}
+
+/* Job notices that arrive mid-edit go where the prompt was; the prompt
+   (its [bg:N] may have changed) and the line are drawn again below them */
+static const char *ed_job_notices(editor_t *e, const char *prompt) {
+    reap_children();
+    if (job_notice_count == 0) return prompt;
+    int rows = 0;
+    for (const char *p = prompt; *p; p++) rows += *p == '\n';
+    char up[32];
+    ed_puts("\r\x1b[0K");
+    if (rows) { snprintf(up, sizeof(up), "\x1b[%dA\x1b[0J", rows); ed_puts(up); }
+    ed_flush();
+    print_job_notices();
+    out_flush();
+
+    prompt = build_cyberpunk_prompt(prompt_cache.last_status);
+    const char *last_line = strrchr(prompt, '\n');
+    last_line = last_line ? last_line + 1 : prompt;
+    e->col0 = display_width(last_line, strlen(last_line)) % term_cols();
+    ed_puts(prompt);
+    ed_refresh(e);
+    return prompt;
+}
+
+static char *read_line_with_tab_completion(const char *prompt) {
+    const char *term = getenv("TERM");
+    struct termios saved;
+    if ((term && strcmp(term, "dumb") == 0) || !isatty(STDOUT_FILENO) || !term_raw(&saved))
+        return read_line_plain(prompt);
+
+    static editor_t e;
+    e.len = e.pos = 0;
+    e.hist = history_loader.loading ? 0 : history_count;
+    e.last_tab = false;
+    ed_reserve(&e, 0);
+    const char *last_line = strrchr(prompt, '\n');
+    last_line = last_line ? last_line + 1 : prompt;
+    e.col0 = display_width(last_line, strlen(last_line)) % term_cols();
+
+    out_flush();
+    ed_puts(prompt);
+    ed_flush();
+
+    char *line = NULL;
+    bool done = false;
+    while (!done) {
+        int k = ed_read_key();
+        bool tab = false;
+        switch (k) {
+        case -2:                        /* EOF on the terminal */
+            done = true;
+            break;
+        case KEY_CHILD:
+            prompt = ed_job_notices(&e, prompt);
+            tab = e.last_tab;           /* not a keypress */
+            break;
+        case '\r':
+        case '\n':
+            ed_puts("\n");
+            ed_flush();
+            line = arena_strndup(&line_arena, e.buf, e.len);
+            done = true;
+            break;
+        case 4:                         /* ^D: EOF on an empty line */
+            if (e.len == 0) { done = true; break; }
+            /* fall through */
+        case KEY_DELETE:
+            if (e.pos < e.len) { ed_delete(&e, e.pos, ed_next_char(&e, e.pos)); ed_refresh(&e); }
+            break;
+        case 3:                         /* ^C: drop the line */
+            ed_puts("^C\n");
+            ed_flush();
+            line = arena_strdup(&line_arena, "");
+            done = true;
+            break;
+        case 127:
+        case 8:
+            if (e.pos > 0) { ed_delete(&e, ed_prev_char(&e, e.pos), e.pos); ed_refresh(&e); }
+            break;
+        case '\t':
+            ed_complete(&e, prompt);
+            tab = true;
+            break;
+        case KEY_LEFT:
+        case 2:                         /* ^B */
+            e.pos = ed_prev_char(&e, e.pos);
+            ed_refresh(&e);
+            break;
+        case KEY_RIGHT:
+        case 6:                         /* ^F */
+            e.pos = ed_next_char(&e, e.pos);
+            ed_refresh(&e);
+            break;
+        case KEY_HOME:
+        case 1:                         /* ^A */
+            e.pos = 0;
+            ed_refresh(&e);
+            break;
+        case KEY_END:
+        case 5:                         /* ^E */
+            e.pos = e.len;
+            ed_refresh(&e);
+            break;
+        case KEY_UP:
+        case 16:                        /* ^P */
+            ed_history(&e, -1);
+            ed_refresh(&e);
+            break;
+        case KEY_DOWN:
+        case 14:                        /* ^N */
+            ed_history(&e, 1);
+            ed_refresh(&e);
+            break;
+        case 11:                        /* ^K */
+            e.len = e.pos;
+            ed_refresh(&e);
+            break;
+        case 21:                        /* ^U */
+            ed_delete(&e, 0, e.pos);
+            ed_refresh(&e);
+            break;
+        case 23: {                      /* ^W */
+            size_t from = e.pos;
+            while (from > 0 && e.buf[from - 1] == ' ') from--;
+            while (from > 0 && e.buf[from - 1] != ' ') from--;
+            ed_delete(&e, from, e.pos);
+            ed_refresh(&e);
+            break;
+        }
+        case 12:                        /* ^L */
+            ed_puts("\x1b[H\x1b[2J");
+            ed_puts(prompt);
+            ed_refresh(&e);
+            break;
+        default:
+            if (k >= 0x20 && k < 0x100 && k != 127) {
+                char ch = (char)k;
+                ed_insert(&e, &ch, 1);
+                ed_refresh(&e);
+            }
+            break;
+        }
+        e.last_tab = tab;
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    return line;
+}
+
+/* Script mode reader: no prompt, no length limit. The getline buffer is
+   reused across lines; the returned copy lives in line_arena. */
+static char *read_script_line(FILE *in) {
+    static char *buf = NULL;
+    static size_t cap = 0;
+    ssize_t r = getline(&buf, &cap, in);
+    if (r == -1) return NULL;
+    if (r > 0 && buf[r-1] == '\n') buf[--r] = '\0';
+    if (r > 0 && buf[r-1] == '\r') buf[--r] = '\0';
+    return arena_strndup(&line_arena, buf, (size_t)r);
 }
 
 /* ---------- Main ---------- */
 
+/* bench/ includes this file with MYSH_NO_MAIN to drive internals directly */
+#ifndef MYSH_NO_MAIN
+
+/* ---------- Startup profile ---------- */
+/* --startup-profile: time from main() to the first prompt (or first script
+   line), by phase. The history loader runs beside the other phases, so
+   its time is shown separately and is not part of the total. */
+
+#define STARTUP_PHASES 8
+
+static struct {
+    bool enabled;
+    uint64_t t0, last;
+    int n;
+    const char *name[STARTUP_PHASES];
+    uint64_t ns[STARTUP_PHASES];
+} startup;
+
+static void startup_mark(const char *name) {
+    if (!startup.enabled) return;
+    uint64_t now = trace_now_ns();
+    if (startup.n < STARTUP_PHASES) {
+        startup.name[startup.n] = name;
+        startup.ns[startup.n++] = now - startup.last;
+    }
+    startup.last = now;
+}
+
+static void startup_report(void) {
+    startup.enabled = false;
+    uint64_t total = trace_now_ns() - startup.t0;
+    bool overlapped = history_loader.loading;
+    history_ensure();
+
+    out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                         STARTUP PROFILE                         " CLR_DARK_GRAY "│\n" CLR_RESET);
+    out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+    char v[64];
+    for (int i = 0; i < startup.n; i++) {
+        snprintf(v, sizeof(v), "%.3f ms", startup.ns[i] / 1e6);
+        print_content_line(startup.name[i], v);
+    }
+    snprintf(v, sizeof(v), "%.3f ms (%s, %d%s)", (history_loader.t1 - history_loader.t0) / 1e6,
+             overlapped ? "background" : "done before prompt", history_count,
+             snap.history_used ? " from snapshot" : " entries");
+    print_content_line("history load", v);
+    print_section_border("TOTAL");
+    snprintf(v, sizeof(v), "%.3f ms", total / 1e6);
+    print_content_line(interactive ? "first prompt" : "first line", v);
+    print_bottom_border();
+    out_end();
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mysh [--startup-profile] [-c command | script]\n");
+    exit(2);
+}
+
 int main(int argc, char **argv) {
-    (void)argc; (void)argv;
+    startup.t0 = startup.last = trace_now_ns();
+    int argi = 1;
+    if (argi < argc && strcmp(argv[argi], "--startup-profile") == 0) {
+        startup.enabled = true;
+        argi++;
+    }
+
+    /* Script mode: mysh -c '...', mysh file.sh, or a non-tty stdin */
+    FILE *script_input = stdin;
+    if (argi < argc) {
+        if (strcmp(argv[argi], "-c") == 0) {
+            if (argi + 1 >= argc) usage();
+            script_input = fmemopen(argv[argi+1], strlen(argv[argi+1]), "r");
+            if (!script_input) { perror("fmemopen"); exit(1); }
+        } else if (argv[argi][0] == '-') {
+            usage();
+        } else {
+            script_input = fopen(argv[argi], "re");
+            if (!script_input) {
+                fprintf(stderr, "mysh: %s: %s\n", argv[argi], strerror(errno));
+                exit(127);
+            }
+        }
+        interactive = false;
+    } else if (!isatty(STDIN_FILENO)) {
+        interactive = false;
+    }
 
     shell_pgid = getpid();
-    if (setpgid(shell_pgid, shell_pgid) < 0) perror("setpgid");
-    tcgetattr(STDIN_FILENO, &shell_tmodes);
-    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    if (interactive) {
+        if (setpgid(shell_pgid, shell_pgid) < 0) perror("setpgid");
+        tcgetattr(STDIN_FILENO, &shell_tmodes);
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
 
     setup_signals();
     signal(SIGINT, sigint_handler);
     signal(SIGTSTP, sigtstp_handler);
+    if (interactive) ev_init();
 
-    load_history();
+    startup_mark("process setup");
+
+    /* config first: it may set HISTSIZE/HISTFILESIZE */
     load_persistent_data();
+    out_setup();        /* after the config, which may set NO_COLOR */
+    const char *trace_to = lookup_var("MYSH_TRACE");
+    if (trace_to && *trace_to && !trace_start(trace_to)) perror(trace_to);
+    startup_mark(snap.config_used ? "config (snapshot)" : "config");
+    history_load_async();
+    startup_mark("history start");
 
     /* sample aliases you can enable if desired:
     add_alias("ll", "ls -l");
@@ -1380,85 +6126,101 @@ int main(int argc, char **argv) {
     add_alias("neo", "echo 'Wake up, Neo...'");
     */
 
-    print_cyberpunk_header();
+    if (interactive) {
+        print_cyberpunk_header();
+        startup_mark("header");
+    }
 
-    char *line = NULL;
-    int last_status = 0;
+    char *line = NULL;  /* owned by line_arena */
     int command_count = 0;
 
     while (1) {
+        /* one reset releases everything the previous line allocated */
+        arena_reset(&line_arena);
+        reap_children();
+        print_job_notices();
         remove_done_jobs();
-        char prompt[PROMPT_BUF];
-        build_cyberpunk_prompt(prompt, sizeof(prompt), last_status);
-
-        line = read_line_with_tab_completion(prompt);
+        if (interactive) {
+            uint64_t t_prompt = trace_begin();
+            const char *prompt = build_cyberpunk_prompt(last_status);
+            trace_end("prompt", t_prompt);
+            if (startup.enabled) {
+                startup_mark("prompt");
+                startup_report();
+            }
+            line = read_line_with_tab_completion(prompt);
+        } else {
+            if (startup.enabled) startup_report();
+            line = read_script_line(script_input);
+        }
         if (!line) {
-            printf("\n");
-            builtin_exit(0, NULL);
+            if (interactive) out_printf("\n");
+            shell_exit(interactive ? 0 : last_status);
             break;
         }
-        if (line[0] == '\0') { free(line); continue; }
+        if (line[0] == '\0') continue;
+        /* Comments and #! lines in scripts */
+        if (!interactive && line[strspn(line, " \t")] == '#') continue;
+        uint64_t t_line = trace_begin();
 
-        char *rawline = strdup_safe(line);
+        char *rawline = line;
         if (rawline[0] == '!' && isdigit((unsigned char)rawline[1])) {
+            history_ensure();
             int id = atoi(rawline+1);
             if (id>=1 && id<=history_count) {
-                free(rawline);
-                rawline = strdup_safe(history[id-1]);
-                printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "HISTORY" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s\n" CLR_RESET, rawline);
+                const hist_entry_t *e = history_at(id-1);
+                rawline = arena_strndup(&line_arena, e->text, e->len);
+                out_printf(CLR_DARK_GRAY "[" CLR_NEON_PURPLE "HISTORY" CLR_DARK_GRAY "] " CLR_LIGHT_GRAY "%s\n" CLR_RESET, rawline);
             } else {
                 print_cyberpunk_error("no such history entry");
-                free(rawline);
-                free(line);
                 continue;
             }
         }
 
+        uint64_t t_push = trace_begin();
         push_history(rawline);
+        trace_end("history", t_push);
         command_count++;
 
-        check_achievements(rawline, command_count);
+        if (interactive) check_achievements(rawline, command_count);
 
         size_t L = strlen(rawline);
-        if (L>0 && rawline[L-1]=='?') {
-            char *preview = strdup_safe(rawline);
+        if (L>0 && rawline[L-1]=='?' && !(L>1 && rawline[L-2]=='$')) {
+            char *preview = arena_strdup(&line_arena, rawline);
             preview[L-1]=0; /* Remove the '?' for tokenization */
 
-            char *expanded_preview = expand_aliases(preview);
             int ntoks;
-            char **toks = tokenize(expanded_preview, &ntoks);
-
-            printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
-            printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        TOKEN PREVIEW                         " CLR_DARK_GRAY "│\n" CLR_RESET);
-            printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
-            printf(CLR_DARK_GRAY "│ " CLR_LIGHT_GRAY);
+            char **toks = tokenize(preview, &ntoks);
+            char **spliced = alias_splice(toks, ntoks, &ntoks);
+            if (spliced) toks = spliced;
+
+            out_printf(CLR_DARK_GRAY "┌─────────────────────────────────────────────────────────────────┐\n" CLR_RESET);
+            out_printf(CLR_DARK_GRAY "│" CLR_NEON_CYAN "                        TOKEN PREVIEW                         " CLR_DARK_GRAY "│\n" CLR_RESET);
+            out_printf(CLR_DARK_GRAY "├─────────────────────────────────────────────────────────────────┤\n" CLR_RESET);
+            out_printf(CLR_DARK_GRAY "│ " CLR_LIGHT_GRAY);
             for (int i=0;i<ntoks;i++) {
-                printf(" '%s'", toks[i]);
+                out_printf(" '%s'", toks[i]);
             }
-            printf(CLR_DARK_GRAY " │\n");
+            out_printf(CLR_DARK_GRAY " │\n");
             print_bottom_border();
 
-            free_tokens(toks, ntoks);
-            free(expanded_preview);
-            free(preview);
-            free(rawline);
-            free(line);
             continue;
         }
 
-        int ntoks;
-        char **toks = tokenize(rawline, &ntoks);
-        if (ntoks == 0) { free_tokens(toks,ntoks); free(rawline); free(line); continue; }
-        pipeline_t pl = parse_tokens(toks, ntoks);
+        cmd_list_t list;
+        uint64_t t_parse = trace_begin();
+        int parsed = parse_list(rawline, &list);
+        trace_end("split", t_parse);
+        if (parsed < 0) { last_status = 2; continue; }
+        if (list.n == 0) continue;
 
-        last_status = execute_pipeline(&pl, rawline);
-
-        free_tokens(toks, ntoks);
-        free(rawline);
-        free(line);
+        last_status = execute_list(&list, false);
+        trace_end_detail("command", t_line, rawline);
     }
 
     save_history();
     save_persistent_data();
     return 0;
 }
+
+#endif /* MYSH_NO_MAIN */